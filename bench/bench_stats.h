@@ -0,0 +1,61 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Summary of repeated measurements. ci95 is the half width of the 95% confidence interval
+// of the mean, from Student's t distribution, so it stays honest for a handful of runs.
+struct Summary
+{
+	int count = 0;
+	double mean = 0.0;
+	double median = 0.0;
+	double min = 0.0;
+	double max = 0.0;
+	double stddev = 0.0;
+	double ci95 = 0.0;
+
+	// Confidence interval half width relative to the mean
+	double relativeError() const { return mean != 0.0 ? ci95 / std::fabs(mean) : 0.0; }
+};
+
+inline double studentT95(int degreesOfFreedom)
+{
+	// Two sided 95% quantiles for 1 to 30 degrees of freedom
+	static const double table[30] = {
+		12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+		2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+		2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+	};
+	if (degreesOfFreedom < 1) return 0.0;
+	return degreesOfFreedom <= 30 ? table[degreesOfFreedom - 1] : 1.960;
+}
+
+inline Summary summarize(std::vector<double> samples)
+{
+	Summary summary;
+	summary.count = static_cast<int>(samples.size());
+	if (samples.empty()) return summary;
+
+	std::sort(samples.begin(), samples.end());
+	size_t n = samples.size();
+	summary.min = samples.front();
+	summary.max = samples.back();
+	summary.median = n % 2 ? samples[n / 2] : 0.5 * (samples[n / 2 - 1] + samples[n / 2]);
+
+	double sum = 0.0;
+	for (double sample : samples)
+		sum += sample;
+	summary.mean = sum / n;
+
+	if (n > 1)
+	{
+		double squares = 0.0;
+		for (double sample : samples)
+			squares += (sample - summary.mean) * (sample - summary.mean);
+		summary.stddev = std::sqrt(squares / (n - 1));
+		summary.ci95 = studentT95(static_cast<int>(n) - 1) * summary.stddev / std::sqrt(static_cast<double>(n));
+	}
+	return summary;
+}
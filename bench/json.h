@@ -0,0 +1,304 @@
+#pragma once
+
+#include "bench_stats.h"
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Just enough JSON for benchmark reports: a streaming writer, and a reader for loading a
+// saved report back as a baseline.
+namespace Json
+{
+	class Writer
+	{
+	public:
+		explicit Writer(std::ostream& out) : out(out) {}
+
+		void beginObject() { open('{'); }
+		void endObject() { close('}'); }
+		void beginArray() { open('['); }
+		void endArray() { close(']'); }
+
+		// Starts a member of the current object; follow with a value or a nested container
+		void key(const std::string& name)
+		{
+			separate();
+			quoted(name);
+			out << ": ";
+			afterKey = true;
+		}
+
+		void value(const std::string& text) { separate(); quoted(text); }
+		void value(const char* text) { value(std::string(text)); }
+		void value(bool flag) { separate(); out << (flag ? "true" : "false"); }
+		void value(int number) { separate(); out << number; }
+		void value(unsigned long long number) { separate(); out << number; }
+
+		void value(double number)
+		{
+			separate();
+			if (!std::isfinite(number))
+			{
+				out << "null";
+				return;
+			}
+			std::ostringstream text;
+			text << std::setprecision(9) << number;
+			out << text.str();
+		}
+
+		void value(const Summary& summary)
+		{
+			beginObject();
+			member("mean", summary.mean);
+			member("median", summary.median);
+			member("min", summary.min);
+			member("max", summary.max);
+			member("stddev", summary.stddev);
+			member("ci95", summary.ci95);
+			member("count", summary.count);
+			endObject();
+		}
+
+		template <typename T>
+		void member(const std::string& name, const T& v)
+		{
+			key(name);
+			value(v);
+		}
+
+	private:
+		std::ostream& out;
+		std::vector<bool> hasItems;		// Per open container
+		bool afterKey = false;
+
+		void separate()
+		{
+			// Values following a key need no separator or indent of their own
+			if (afterKey)
+			{
+				afterKey = false;
+				return;
+			}
+			if (hasItems.empty()) return;
+
+			if (hasItems.back()) out << ",";
+			hasItems.back() = true;
+			out << "\n" << std::string(hasItems.size(), '\t');
+		}
+
+		void open(char bracket)
+		{
+			separate();
+			out << bracket;
+			hasItems.push_back(false);
+		}
+
+		void close(char bracket)
+		{
+			bool items = hasItems.back();
+			hasItems.pop_back();
+			if (items) out << "\n" << std::string(hasItems.size(), '\t');
+			out << bracket;
+			if (hasItems.empty()) out << "\n";
+		}
+
+		void quoted(const std::string& text)
+		{
+			out << '"';
+			for (char c : text)
+			{
+				if (c == '"' || c == '\\') out << '\\' << c;
+				else if (c == '\n') out << "\\n";
+				else if (static_cast<unsigned char>(c) < 0x20)
+				{
+					char escaped[8];
+					std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+					out << escaped;
+				}
+				else out << c;
+			}
+			out << '"';
+		}
+	};
+
+	struct Value
+	{
+		enum class Type { Null, Bool, Number, String, Array, Object };
+
+		Type type = Type::Null;
+		bool boolean = false;
+		double number = 0.0;
+		std::string text;
+		std::vector<Value> items;
+		std::vector<std::pair<std::string, Value>> members;
+
+		// Member lookup that returns a null value when missing, so paths can be chained
+		const Value& operator[](const std::string& name) const
+		{
+			for (const auto& member : members)
+			{
+				if (member.first == name) return member.second;
+			}
+			static const Value null;
+			return null;
+		}
+
+		bool isNull() const { return type == Type::Null; }
+	};
+
+	class Reader
+	{
+	public:
+		// Parses a whole document, returning false on malformed input
+		static bool parse(const std::string& text, Value& value)
+		{
+			Reader reader(text);
+			if (!reader.parseValue(value)) return false;
+			reader.skipSpace();
+			return reader.position == text.size();
+		}
+
+		static bool load(const std::string& filename, Value& value)
+		{
+			std::ifstream file(filename, std::ios::binary);
+			if (!file) return false;
+			std::stringstream text;
+			text << file.rdbuf();
+			return parse(text.str(), value);
+		}
+
+	private:
+		const std::string& text;
+		size_t position = 0;
+
+		explicit Reader(const std::string& text) : text(text) {}
+
+		void skipSpace()
+		{
+			while (position < text.size() && std::isspace(static_cast<unsigned char>(text[position])))
+				position++;
+		}
+
+		bool consume(const char* word)
+		{
+			size_t length = std::char_traits<char>::length(word);
+			if (text.compare(position, length, word) != 0) return false;
+			position += length;
+			return true;
+		}
+
+		bool parseValue(Value& value)
+		{
+			skipSpace();
+			if (position >= text.size()) return false;
+
+			char c = text[position];
+			if (c == '{') return parseObject(value);
+			if (c == '[') return parseArray(value);
+			if (c == '"')
+			{
+				value.type = Value::Type::String;
+				return parseString(value.text);
+			}
+			if (consume("true") || consume("false"))
+			{
+				value.type = Value::Type::Bool;
+				value.boolean = c == 't';
+				return true;
+			}
+			if (consume("null"))
+			{
+				value.type = Value::Type::Null;
+				return true;
+			}
+
+			const char* start = text.c_str() + position;
+			char* end;
+			value.number = std::strtod(start, &end);
+			if (end == start) return false;
+			value.type = Value::Type::Number;
+			position += end - start;
+			return true;
+		}
+
+		bool parseString(std::string& out)
+		{
+			position++;
+			while (position < text.size() && text[position] != '"')
+			{
+				char c = text[position++];
+				if (c != '\\')
+				{
+					out += c;
+					continue;
+				}
+				if (position >= text.size()) return false;
+
+				char escape = text[position++];
+				if (escape == 'n') out += '\n';
+				else if (escape == 't') out += '\t';
+				else if (escape == 'u')
+				{
+					// Reports only escape control characters, which fit in one byte
+					if (position + 4 > text.size()) return false;
+					out += static_cast<char>(std::strtol(text.substr(position, 4).c_str(), nullptr, 16));
+					position += 4;
+				}
+				else out += escape;
+			}
+			if (position >= text.size()) return false;
+			position++;
+			return true;
+		}
+
+		bool parseArray(Value& value)
+		{
+			value.type = Value::Type::Array;
+			position++;
+			skipSpace();
+			if (consume("]")) return true;
+
+			while (true)
+			{
+				value.items.emplace_back();
+				if (!parseValue(value.items.back())) return false;
+				skipSpace();
+				if (consume("]")) return true;
+				if (!consume(",")) return false;
+			}
+		}
+
+		bool parseObject(Value& value)
+		{
+			value.type = Value::Type::Object;
+			position++;
+			skipSpace();
+			if (consume("}")) return true;
+
+			while (true)
+			{
+				skipSpace();
+				if (position >= text.size() || text[position] != '"') return false;
+
+				value.members.emplace_back();
+				if (!parseString(value.members.back().first)) return false;
+				skipSpace();
+				if (!consume(":")) return false;
+				if (!parseValue(value.members.back().second)) return false;
+				skipSpace();
+				if (consume("}")) return true;
+				if (!consume(",")) return false;
+			}
+		}
+	};
+}
@@ -0,0 +1,580 @@
+#include "raytracer.h"
+
+#include "bvh.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "quad.h"
+#include "sphere.h"
+#include "timing.h"
+
+#include "bench_stats.h"
+#include "json.h"
+
+#include <cstring>
+#include <fstream>
+
+// Micro-benchmarks of the intersection and sampling kernels in isolation. Each kernel runs
+// over a fixed, seeded set of inputs drawn from one of three ray distributions:
+//   coherent  parallel rays from a grid in front of the target, as camera rays
+//   random    random origins and directions, as diffuse bounces
+//   grazing   rays nearly parallel to the surface or slab, where precision and early
+//             outs are stressed
+// After calibrating a loop count long enough to time reliably, which doubles as warmup,
+// every kernel is timed over a number of samples and reported as the median ns/op with the
+// 95% confidence interval of the mean, and throughput in millions of ops per second.
+//
+// Before timing, kernels with a simpler reference implementation are checked against it,
+// and the run fails if any result differs.
+
+const char* usage =
+	"Usage: KernelBench [options]\n"
+	"  --filter <text>          Only run benchmarks whose name contains the text\n"
+	"  --samples <n>            Timed samples per benchmark (default 15)\n"
+	"  --min-time <ms>          Minimum duration of one sample (default 10)\n"
+	"  --max-primitives <n>     Largest BVH scene, up to 10000000 (default 1000000)\n"
+	"  --bvh <builder>          median or sah (default median)\n"
+	"  --json <file>            Also write the results as JSON\n"
+	"  --check                  Only check the kernels against their references\n";
+
+struct KernelOptions
+{
+	std::string filter;
+	int samples = 15;
+	double minTime = 0.010;
+	int maxPrimitives = 1000000;
+	BVHBuilder bvh = BVHBuilder::Median;
+	std::string bvhName = "median";
+	std::string jsonFile;
+	bool checkOnly = false;
+};
+
+struct KernelResult
+{
+	std::string name;
+	std::string distribution;
+	Summary nsPerOp;
+	double hitRate;					// Fraction of ops that reported a hit or a scatter, or -1
+	double buildSeconds;			// For BVH benchmarks, or 0
+};
+
+// Inputs are cycled through in a power of two sized set
+const size_t inputCount = 4096;
+
+enum class Distribution { Coherent, Random, Grazing };
+
+const Distribution distributions[] = { Distribution::Coherent, Distribution::Random, Distribution::Grazing };
+
+const char* distributionName(Distribution distribution)
+{
+	switch (distribution)
+	{
+	case Distribution::Coherent: return "coherent";
+	case Distribution::Random: return "random";
+	default: return "grazing";
+	}
+}
+
+// Stops the compiler from discarding the measured work
+volatile float sink;
+
+// Forces a value to be computed where it stands. Without it the optimizer may sink a loop
+// of pure kernel calls past the clock read that ends the timing.
+inline void keep(bool value)
+{
+#if defined(__GNUC__)
+	asm volatile("" : : "r,m"(value) : "memory");
+#else
+	sink = value;
+#endif
+}
+
+// Times op(i) for i cycling over the inputs. The op returns whether it hit, which feeds the
+// sink and the hit rate. It is a template parameter so the kernel inlines into the loop.
+template <typename F>
+static Summary measure(F op, const KernelOptions& options, double& hitRate)
+{
+	auto runLoop = [&](size_t iterations, size_t& hits) {
+		auto start = Timings::Clock::now();
+		for (size_t i = 0; i < iterations; i++)
+		{
+			bool hit = op(i & (inputCount - 1));
+			keep(hit);
+			hits += hit;
+		}
+		return Timings::seconds(start, Timings::Clock::now());
+	};
+
+	// Calibrate the loop count, which also warms the caches and branch predictors
+	size_t iterations = inputCount;
+	size_t hits = 0;
+	while (runLoop(iterations, hits) < options.minTime && iterations < (size_t(1) << 40))
+		iterations *= 2;
+
+	std::vector<double> samples;
+	hits = 0;
+	for (int s = 0; s < options.samples; s++)
+		samples.push_back(1e9 * runLoop(iterations, hits) / iterations);
+	sink = static_cast<float>(hits);
+
+	hitRate = static_cast<double>(hits) / (static_cast<double>(iterations) * options.samples);
+	return summarize(samples);
+}
+
+// Ray sets
+
+static std::vector<Ray> coherentRays(float halfWidth, float distance)
+{
+	// A grid of parallel rays along +z covering the square in front of the target
+	std::vector<Ray> rays;
+	int side = 64;
+	for (int j = 0; j < side; j++)
+	{
+		for (int i = 0; i < side; i++)
+		{
+			float x = halfWidth * (2.0f * (i + 0.5f) / side - 1.0f);
+			float y = halfWidth * (2.0f * (j + 0.5f) / side - 1.0f);
+			rays.emplace_back(Point3(x, y, -distance), Vec3(0.0f, 0.0f, 1.0f));
+		}
+	}
+	return rays;
+}
+
+static std::vector<Ray> randomRays(float extent)
+{
+	std::vector<Ray> rays;
+	for (size_t i = 0; i < inputCount; i++)
+		rays.emplace_back(Vec3::random(-extent, extent), randomUnitVector());
+	return rays;
+}
+
+static std::vector<Ray> grazingSlabRays()
+{
+	// Rays skimming the top face of the [-1, 1] cube, within a hair of its plane
+	std::vector<Ray> rays;
+	for (size_t i = 0; i < inputCount; i++)
+	{
+		float offset = randomFloat(-1e-3f, 1e-3f);
+		Point3 origin(-3.0f, 1.0f + offset, randomFloat(-1.0f, 1.0f));
+		Vec3 dir(1.0f, randomFloat(-1e-3f, 1e-3f), randomFloat(-0.1f, 0.1f));
+		rays.emplace_back(origin, dir);
+	}
+	return rays;
+}
+
+static std::vector<Ray> grazingSphereRays()
+{
+	// Rays passing the unit sphere at the origin within 1% of tangent
+	std::vector<Ray> rays;
+	for (size_t i = 0; i < inputCount; i++)
+	{
+		float angle = randomFloat(0.0f, 2.0f * pi);
+		float distance = randomFloat(0.99f, 1.01f);
+		Point3 origin(distance * std::cos(angle), distance * std::sin(angle), -5.0f);
+		rays.emplace_back(origin, Vec3(0.0f, 0.0f, 1.0f));
+	}
+	return rays;
+}
+
+static std::vector<Ray> grazingPlaneRays()
+{
+	// Rays nearly parallel to the z = 0 plane of the quad, crossing it at shallow angles
+	std::vector<Ray> rays;
+	for (size_t i = 0; i < inputCount; i++)
+	{
+		Point3 origin(-3.0f, randomFloat(-1.0f, 1.0f), randomFloat(-1e-2f, 1e-2f));
+		Vec3 dir(1.0f, randomFloat(-0.2f, 0.2f), randomFloat(-1e-2f, 1e-2f));
+		rays.emplace_back(origin, dir);
+	}
+	return rays;
+}
+
+static std::vector<Ray> rays(Distribution distribution, std::vector<Ray> (*grazing)())
+{
+	switch (distribution)
+	{
+	case Distribution::Coherent: return coherentRays(1.5f, 5.0f);
+	case Distribution::Random: return randomRays(3.0f);
+	default: return grazing();
+	}
+}
+
+// Reference checks
+
+// The per-axis slab test AABB::hit replaced, dividing by each direction component and
+// ordering the slab distances by comparison. Zero components are handled explicitly: the ray
+// is inside the slab when its origin is inside or on either plane.
+static bool referenceSlabHit(const AABB& box, const Ray& ray, Interval rayT)
+{
+	for (int axis = 0; axis < 3; axis++)
+	{
+		const Interval& ax = box.axisInterval(axis);
+		float origin = ray.origin[axis];
+		if (ray.dir[axis] == 0.0f)
+		{
+			if (origin < ax.min || origin > ax.max) return false;
+			continue;
+		}
+
+		const float axDirInv = 1.0f / ray.dir[axis];
+		float t0 = (ax.min - origin) * axDirInv;
+		float t1 = (ax.max - origin) * axDirInv;
+		if (t0 > t1) std::swap(t0, t1);
+		if (t0 > rayT.min) rayT.min = t0;
+		if (t1 < rayT.max) rayT.max = t1;
+		if (rayT.max <= rayT.min) return false;
+	}
+	return true;
+}
+
+static void setAxis(Vec3& v, int axis, float value)
+{
+	(axis == 0 ? v.x : axis == 1 ? v.y : v.z) = value;
+}
+
+static std::ostream& operator<<(std::ostream& out, const Vec3& v)
+{
+	return out << v.x << " " << v.y << " " << v.z;
+}
+
+static bool checkSlabTest()
+{
+	// Random boxes against random, axis-parallel, zero-component and grazing rays
+	seedRandom(7);
+	std::vector<Ray> input = randomRays(3.0f);
+	std::vector<Ray> grazing = grazingSlabRays();
+	input.insert(input.end(), grazing.begin(), grazing.end());
+	for (size_t i = 0; i < inputCount; i++)
+	{
+		Point3 origin = Vec3::random(-3.0f, 3.0f);
+		Vec3 axisDir;
+		setAxis(axisDir, i % 3, (i / 3) % 2 ? -1.0f : 1.0f);
+		input.emplace_back(origin, axisDir);
+
+		Vec3 dir = randomUnitVector();
+		setAxis(dir, i % 3, 0.0f);
+		if ((i / 3) % 2) setAxis(dir, (i + 1) % 3, -0.0f);
+		input.emplace_back(origin, dir);
+
+		// Origins exactly on a face of the unit box, with the direction along the face
+		Point3 onFace = Vec3::random(-1.0f, 1.0f);
+		setAxis(onFace, i % 3, (i / 3) % 2 ? -1.0f : 1.0f);
+		Vec3 alongFace = randomUnitVector();
+		setAxis(alongFace, i % 3, 0.0f);
+		input.emplace_back(onFace, alongFace);
+	}
+
+	size_t mismatches = 0, cases = 0, hits = 0;
+	for (int b = 0; b < 64; b++)
+	{
+		AABB box = b == 0 ? AABB(Point3(-1.0f, -1.0f, -1.0f), Point3(1.0f, 1.0f, 1.0f))
+			: AABB(Vec3::random(-2.0f, 0.0f), Vec3::random(0.0f, 2.0f));
+		for (const Ray& ray : input)
+		{
+			Interval rayT(0.001f, b % 2 ? infinity : 4.0f);
+			bool expected = referenceSlabHit(box, ray, rayT);
+			bool result = box.hit(ray, rayT);
+			cases++;
+			hits += expected;
+			if (result != expected && mismatches++ < 5)
+			{
+				std::cerr << "AABB::hit returned " << result << " for origin " << ray.origin
+					<< " direction " << ray.dir << ", the reference " << expected << "\n";
+			}
+		}
+	}
+
+	std::cout << "AABB::hit check: " << cases << " cases, " << hits << " hits, "
+		<< mismatches << " mismatches\n";
+	return mismatches == 0;
+}
+
+// Benchmarks
+
+class KernelBench
+{
+public:
+	explicit KernelBench(const KernelOptions& options) : options(options) {}
+
+	void run()
+	{
+		std::cout << std::left << std::setw(32) << "benchmark" << std::setw(10) << "rays"
+			<< std::right << std::setw(12) << "ns/op" << std::setw(10) << "+/-"
+			<< std::setw(12) << "Mops/s" << std::setw(10) << "hit rate" << "\n";
+
+		benchPrimitives();
+		benchBVH();
+		benchSampling();
+	}
+
+	const std::vector<KernelResult>& results() const { return reports; }
+
+private:
+	KernelOptions options;
+	std::vector<KernelResult> reports;
+
+	bool selected(const std::string& name) const
+	{
+		return options.filter.empty() || name.find(options.filter) != std::string::npos;
+	}
+
+	void report(const std::string& name, const std::string& distribution, const Summary& ns, double hitRate, double buildSeconds = 0.0)
+	{
+		reports.push_back(KernelResult{ name, distribution, ns, hitRate, buildSeconds });
+
+		std::cout << std::left << std::setw(32) << name << std::setw(10) << distribution << std::right
+			<< std::fixed << std::setprecision(2) << std::setw(12) << ns.median
+			<< std::setw(9) << std::setprecision(1) << 100.0 * ns.relativeError() << "%"
+			<< std::setw(12) << std::setprecision(1) << 1e3 / ns.median;
+		if (hitRate >= 0.0)
+			std::cout << std::setw(9) << std::setprecision(1) << 100.0 * hitRate << "%";
+		if (buildSeconds > 0.0)
+			std::cout << "   build " << std::setprecision(3) << buildSeconds << " s";
+		std::cout << "\n" << std::flush;
+		std::cout.unsetf(std::ios::floatfield);
+	}
+
+	void benchHittable(const std::string& name, const Hittable& object, std::vector<Ray> (*grazing)(), double buildSeconds = 0.0)
+	{
+		for (Distribution distribution : distributions)
+		{
+			seedRandom(1);
+			std::vector<Ray> input = rays(distribution, grazing);
+			double hitRate;
+			Summary ns = measure([&](size_t i) {
+				RayHit rayHit;
+				return object.hit(input[i], Interval(0.001f, infinity), rayHit);
+			}, options, hitRate);
+			report(name, distributionName(distribution), ns, hitRate, buildSeconds);
+		}
+	}
+
+	void benchPrimitives()
+	{
+		if (selected("AABB::hit"))
+		{
+			AABB box(Point3(-1.0f, -1.0f, -1.0f), Point3(1.0f, 1.0f, 1.0f));
+			for (Distribution distribution : distributions)
+			{
+				seedRandom(1);
+				std::vector<Ray> input = rays(distribution, grazingSlabRays);
+				double hitRate;
+				Summary ns = measure([&](size_t i) {
+					return box.hit(input[i], Interval(0.001f, infinity));
+				}, options, hitRate);
+				report("AABB::hit", distributionName(distribution), ns, hitRate);
+			}
+		}
+
+		auto mat = std::make_shared<Lambertian>(Color(0.5f, 0.5f, 0.5f));
+		if (selected("Sphere::hit"))
+		{
+			Sphere sphere(Point3(0.0f, 0.0f, 0.0f), 1.0f, mat);
+			benchHittable("Sphere::hit", sphere, grazingSphereRays);
+		}
+		if (selected("Quad::hit"))
+		{
+			Quad quad(Point3(-1.0f, -1.0f, 0.0f), Vec3(2.0f, 0.0f, 0.0f), Vec3(0.0f, 2.0f, 0.0f), mat);
+			benchHittable("Quad::hit", quad, grazingPlaneRays);
+		}
+	}
+
+	void benchBVH()
+	{
+		auto mat = std::make_shared<Lambertian>(Color(0.5f, 0.5f, 0.5f));
+		for (int count = 1000; count <= options.maxPrimitives; count *= 10)
+		{
+			std::string name = "BVHNode::hit " + std::to_string(count);
+			if (!selected(name)) continue;
+
+			// Spheres filling the [-1, 1] cube at the same density whatever their number
+			double buildSeconds;
+			std::shared_ptr<BVHNode> bvh;
+			{
+				seedRandom(count);
+				float radius = 0.5f / std::cbrt(static_cast<float>(count));
+				HittableList spheres;
+				spheres.objects.reserve(count);
+				for (int i = 0; i < count; i++)
+					spheres.add(std::make_shared<Sphere>(Vec3::random(-1.0f + radius, 1.0f - radius), radius, mat));
+
+				auto start = Timings::Clock::now();
+				bvh = std::make_shared<BVHNode>(spheres, options.bvh);
+				buildSeconds = Timings::seconds(start, Timings::Clock::now());
+			}
+
+			benchHittable(name, *bvh, grazingSlabRays, buildSeconds);
+		}
+	}
+
+	void benchSampling()
+	{
+		if (selected("randomUnitVector"))
+		{
+			double hitRate;
+			Summary ns = measure([](size_t) { return randomUnitVector().x > 0.0f; }, options, hitRate);
+			report("randomUnitVector", "-", ns, -1.0);
+		}
+
+		// Each material scatters from hits on the unit sphere by rays of each distribution
+		std::shared_ptr<Material> materials[] = {
+			std::make_shared<Lambertian>(Color(0.5f, 0.5f, 0.5f)),
+			std::make_shared<Metal>(Color(0.8f, 0.8f, 0.8f), 0.3f),
+			std::make_shared<Dielectric>(1.5f)
+		};
+		const char* names[] = { "Lambertian::scatter", "Metal::scatter", "Dielectric::scatter" };
+
+		Sphere sphere(Point3(0.0f, 0.0f, 0.0f), 1.0f, materials[0]);
+		for (int m = 0; m < 3; m++)
+		{
+			if (!selected(names[m])) continue;
+
+			for (Distribution distribution : distributions)
+			{
+				seedRandom(1);
+				std::vector<Ray> input = rays(distribution, grazingSphereRays);
+
+				// Keep the rays that hit, cycling them to fill the input set
+				std::vector<Ray> hitRays;
+				std::vector<HitRecord> records;
+				for (const auto& ray : input)
+				{
+					RayHit rayHit;
+					if (!sphere.hit(ray, Interval(0.001f, infinity), rayHit)) continue;
+
+					HitRecord record;
+					sphere.surfaceInteraction(ray, rayHit, record);
+					hitRays.push_back(ray);
+					records.push_back(record);
+				}
+				if (records.empty()) continue;
+				for (size_t i = 0; records.size() < inputCount; i++)
+				{
+					hitRays.push_back(hitRays[i]);
+					records.push_back(records[i]);
+				}
+
+				const Material& material = *materials[m];
+				double hitRate;
+				Summary ns = measure([&](size_t i) {
+					Color attenuation;
+					Ray scattered;
+					bool scatteredRay = material.scatter(hitRays[i], records[i], attenuation, scattered);
+					return scatteredRay && scattered.dir.x > -2.0f;
+				}, options, hitRate);
+				report(names[m], distributionName(distribution), ns, hitRate);
+			}
+		}
+	}
+};
+
+static void writeReport(std::ostream& out, const KernelOptions& options, const std::vector<KernelResult>& results)
+{
+	Json::Writer json(out);
+	json.beginObject();
+	json.member("benchmark", "kernels");
+	json.member("samples", options.samples);
+	json.member("min_sample_seconds", options.minTime);
+	json.member("bvh", options.bvhName);
+
+	json.key("results");
+	json.beginArray();
+	for (const auto& result : results)
+	{
+		json.beginObject();
+		json.member("name", result.name);
+		json.member("rays", result.distribution);
+		json.member("ns_per_op", result.nsPerOp);
+		json.member("mops_per_second", 1e3 / result.nsPerOp.median);
+		if (result.hitRate >= 0.0)
+			json.member("hit_rate", result.hitRate);
+		if (result.buildSeconds > 0.0)
+			json.member("build_seconds", result.buildSeconds);
+		json.endObject();
+	}
+	json.endArray();
+	json.endObject();
+}
+
+static bool parseOptions(int argc, char* argv[], KernelOptions& options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "--check")
+		{
+			options.checkOnly = true;
+			continue;
+		}
+		if (arg == "--help" || arg == "-h" || i + 1 >= argc)
+		{
+			std::cerr << usage;
+			return false;
+		}
+		const char* value = argv[++i];
+
+		bool ok = true;
+		if (arg == "--filter") options.filter = value;
+		else if (arg == "--samples")
+		{
+			options.samples = std::atoi(value);
+			ok = options.samples >= 2;
+		}
+		else if (arg == "--min-time")
+		{
+			options.minTime = std::atof(value) / 1000.0;
+			ok = options.minTime > 0.0;
+		}
+		else if (arg == "--max-primitives")
+		{
+			options.maxPrimitives = std::atoi(value);
+			ok = options.maxPrimitives >= 1000 && options.maxPrimitives <= 10000000;
+		}
+		else if (arg == "--bvh")
+		{
+			options.bvhName = value;
+			if (options.bvhName == "median") options.bvh = BVHBuilder::Median;
+			else if (options.bvhName == "sah") options.bvh = BVHBuilder::SAH;
+			else ok = false;
+		}
+		else if (arg == "--json") options.jsonFile = value;
+		else
+		{
+			std::cerr << "Unknown option " << arg << ".\n" << usage;
+			return false;
+		}
+
+		if (!ok)
+		{
+			std::cerr << "Invalid value '" << value << "' for " << arg << ".\n";
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	KernelOptions options;
+	if (!parseOptions(argc, argv, options))
+		return 1;
+
+	if (!checkSlabTest())
+		return 1;
+	if (options.checkOnly)
+		return 0;
+
+	KernelBench bench(options);
+	bench.run();
+
+	if (!options.jsonFile.empty())
+	{
+		std::ofstream file(options.jsonFile);
+		writeReport(file, options, bench.results());
+		if (!file)
+		{
+			std::cerr << "ERROR: Could not write '" << options.jsonFile << "'.\n";
+			return 1;
+		}
+		std::cerr << "Results saved to " << options.jsonFile << "\n";
+	}
+}
@@ -0,0 +1,462 @@
+#include "raytracer.h"
+
+#include "camera.h"
+#include "scene_parser.h"
+#include "timing.h"
+
+#include "bench_stats.h"
+#include "json.h"
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+// End to end benchmark of the sample scenes: renders each at a fixed size, sample count and
+// seed, repeats the run, and reports the time of every phase and the ray throughput as
+// JSON. Given a saved report as a baseline, it flags scenes whose render time regressed
+// beyond the noise of both runs, and exits with status 2 if any did.
+
+const char* usage =
+	"Usage: RenderBench [options]\n"
+	"  --scenes <list>          Comma separated scene files or sample numbers (default 1,2,3,4,5)\n"
+	"  --resolution <w>         Image width; heights follow each scene's aspect ratio (default 320)\n"
+	"  --spp <n>                Samples per pixel (default 16)\n"
+	"  --depth <n>              Maximum ray depth (default each scene's)\n"
+	"  --threads <n>            Render threads (default one per hardware thread)\n"
+	"  --bvh <builder>          median, sah or none (default median)\n"
+	"  --seed <n>               Random seed (default 1)\n"
+	"  --warmup <n>             Untimed runs per scene (default 1)\n"
+	"  --repeat <n>             Timed runs per scene (default 5)\n"
+	"  --format <ext>           Image format written each run: png, hdr, pfm or exr (default png)\n"
+	"  --json <file>            Write the report to a file instead of standard output\n"
+	"  --baseline <file>        Compare against a saved report\n"
+	"  --tolerance <percent>    Slowdown allowed before a regression is reported (default 5)\n";
+
+struct BenchOptions
+{
+	std::vector<std::string> scenes;
+	int width = 320;
+	int samplesPerPixel = 16;
+	int maxDepth = 0;
+	int threads = 0;
+	BVHBuilder bvh = BVHBuilder::Median;
+	std::string bvhName = "median";
+	uint32_t seed = 1;
+	int warmup = 1;
+	int repeat = 5;
+	std::string format = "png";
+	std::string jsonFile;
+	std::string baselineFile;
+	double tolerance = 5.0;
+};
+
+// Measurements of one timed run
+struct Run
+{
+	double parse, bvhBuild, textureWait, render, write, total;
+	uint64_t cameraRays, secondaryRays;
+	uint64_t imageHash;
+	TraversalStats traversal;		// Only counted when built with RAYTRACER_STATS
+};
+
+struct SceneResult
+{
+	std::string name;
+	int width = 0, height = 0;
+	std::vector<Run> runs;
+	bool failed = false;
+};
+
+// Silences the renderer's progress output while a run is timed
+class QuietOutput
+{
+public:
+	QuietOutput() : coutBuffer(std::cout.rdbuf(nullptr)), clogBuffer(std::clog.rdbuf(nullptr)) {}
+	~QuietOutput()
+	{
+		std::cout.rdbuf(coutBuffer);
+		std::clog.rdbuf(clogBuffer);
+		std::cout.clear();
+		std::clog.clear();
+	}
+
+private:
+	std::streambuf* coutBuffer;
+	std::streambuf* clogBuffer;
+};
+
+static uint64_t hashImage(const std::vector<Color>& image)
+{
+	// FNV-1a over the raw floats: any change to the rendered image changes the hash
+	uint64_t hash = 1469598103934665603ull;
+	const unsigned char* bytes = reinterpret_cast<const unsigned char*>(image.data());
+	for (size_t i = 0; i < image.size() * sizeof(Color); i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+static std::string hexHash(uint64_t hash)
+{
+	std::ostringstream text;
+	text << std::hex << std::setw(16) << std::setfill('0') << hash;
+	return text.str();
+}
+
+static std::string sceneName(const std::string& file)
+{
+	size_t slash = file.find_last_of("/\\");
+	std::string name = slash == std::string::npos ? file : file.substr(slash + 1);
+	size_t dot = name.find_last_of('.');
+	return dot == std::string::npos ? name : name.substr(0, dot);
+}
+
+static bool runScene(const std::string& file, const BenchOptions& options, Run& run, int& width, int& height)
+{
+	QuietOutput quiet;
+	Timings::instance().reset();
+
+	Scene scene;
+	if (!SceneParser::load(file, scene, options.bvh))
+		return false;
+
+	Camera& camera = scene.camera;
+	camera.imageWidth = options.width;
+	camera.samplesPerPixel = options.samplesPerPixel;
+	if (options.maxDepth > 0) camera.maxDepth = options.maxDepth;
+	camera.threadCount = options.threads;
+	camera.seed = options.seed;
+	camera.outputFile = "bench." + sceneName(file) + "." + options.format;
+	camera.render(scene.world);
+
+	const Timings& timings = Timings::instance();
+	run.parse = timings.get("Scene parse");
+	run.bvhBuild = timings.get("BVH build");
+	run.textureWait = timings.get("Texture wait");
+	run.render = timings.get("Render");
+	run.write = timings.get("Image write");
+	run.total = timings.elapsed();
+	run.cameraRays = camera.cameraRays();
+	run.secondaryRays = camera.secondaryRays();
+	run.imageHash = hashImage(camera.image());
+	run.traversal = camera.traversalStats();
+	width = camera.imageWidth;
+	height = camera.height();
+	return true;
+}
+
+template <typename F>
+static Summary summarizeRuns(const std::vector<Run>& runs, F metric)
+{
+	std::vector<double> samples;
+	for (const auto& run : runs)
+		samples.push_back(metric(run));
+	return summarize(samples);
+}
+
+static double parseTime(const Run& run) { return run.parse; }
+static double bvhTime(const Run& run) { return run.bvhBuild; }
+static double textureTime(const Run& run) { return run.textureWait; }
+static double renderTime(const Run& run) { return run.render; }
+static double writeTime(const Run& run) { return run.write; }
+static double totalTime(const Run& run) { return run.total; }
+static double raysPerSecond(const Run& run) { return (run.cameraRays + run.secondaryRays) / run.render; }
+static double cameraRaysPerSecond(const Run& run) { return run.cameraRays / run.render; }
+static double secondaryRaysPerSecond(const Run& run) { return run.secondaryRays / run.render; }
+
+static void writeReport(std::ostream& out, const BenchOptions& options, const std::vector<SceneResult>& results)
+{
+	Json::Writer json(out);
+	json.beginObject();
+	json.member("benchmark", "render");
+
+	json.key("config");
+	json.beginObject();
+	json.member("width", options.width);
+	json.member("spp", options.samplesPerPixel);
+	json.member("depth", options.maxDepth);
+	json.member("threads", options.threads > 0 ? options.threads : static_cast<int>(std::max(1u, std::thread::hardware_concurrency())));
+	json.member("bvh", options.bvhName);
+	json.member("seed", static_cast<unsigned long long>(options.seed));
+	json.member("warmup", options.warmup);
+	json.member("repeat", options.repeat);
+	json.endObject();
+
+	json.key("scenes");
+	json.beginArray();
+	for (const auto& result : results)
+	{
+		if (result.failed || result.runs.empty()) continue;
+
+		const Run& first = result.runs.front();
+		bool deterministic = true;
+		for (const auto& run : result.runs)
+			deterministic = deterministic && run.imageHash == first.imageHash;
+
+		json.beginObject();
+		json.member("name", result.name);
+		json.member("width", result.width);
+		json.member("height", result.height);
+		json.member("image_hash", hexHash(first.imageHash));
+		json.member("deterministic", deterministic);
+		json.member("camera_rays", static_cast<unsigned long long>(first.cameraRays));
+		json.member("secondary_rays", static_cast<unsigned long long>(first.secondaryRays));
+
+		json.key("seconds");
+		json.beginObject();
+		json.member("parse", summarizeRuns(result.runs, parseTime));
+		json.member("bvh_build", summarizeRuns(result.runs, bvhTime));
+		json.member("texture_wait", summarizeRuns(result.runs, textureTime));
+		json.member("render", summarizeRuns(result.runs, renderTime));
+		json.member("write", summarizeRuns(result.runs, writeTime));
+		json.member("total", summarizeRuns(result.runs, totalTime));
+		json.endObject();
+
+		if (Stats::enabled)
+		{
+			const TraversalStats& traversal = first.traversal;
+			double perRay = traversal.rays > 0 ? 1.0 / traversal.rays : 0.0;
+			json.key("traversal");
+			json.beginObject();
+			json.member("nodes_per_ray", traversal.nodesVisited * perRay);
+			json.member("aabb_tests_per_ray", traversal.aabbTests * perRay);
+			json.member("primitive_tests_per_ray", traversal.primitiveTests * perRay);
+			json.member("primitive_hits_per_ray", traversal.primitiveHits * perRay);
+			json.endObject();
+		}
+
+		json.key("rays_per_second");
+		json.beginObject();
+		json.member("all", summarizeRuns(result.runs, raysPerSecond));
+		json.member("camera", summarizeRuns(result.runs, cameraRaysPerSecond));
+		json.member("secondary", summarizeRuns(result.runs, secondaryRaysPerSecond));
+		json.endObject();
+
+		json.endObject();
+	}
+	json.endArray();
+	json.endObject();
+}
+
+// Compares render times with a saved report. Returns the number of regressions.
+static int compareBaseline(const Json::Value& baseline, const BenchOptions& options, const std::vector<SceneResult>& results)
+{
+	const Json::Value& config = baseline["config"];
+	if (config["width"].number != options.width || config["spp"].number != options.samplesPerPixel
+		|| config["seed"].number != options.seed)
+	{
+		std::cerr << "Warning: the baseline was run with different settings, so times may not be comparable\n";
+	}
+
+	int regressions = 0;
+	std::cerr << "\nComparison with baseline (render time median, 95% confidence):\n";
+	for (const auto& result : results)
+	{
+		if (result.failed || result.runs.empty()) continue;
+
+		const Json::Value* previous = nullptr;
+		for (const auto& scene : baseline["scenes"].items)
+		{
+			if (scene["name"].text == result.name) previous = &scene;
+		}
+		if (!previous)
+		{
+			std::cerr << "  " << std::left << std::setw(20) << result.name << "not in baseline\n";
+			continue;
+		}
+
+		const Json::Value& before = (*previous)["seconds"]["render"];
+		Summary now = summarizeRuns(result.runs, renderTime);
+		double change = 100.0 * (now.median / before["median"].number - 1.0);
+
+		// A regression must exceed both the tolerance and the combined run to run noise
+		double noise = now.ci95 + before["ci95"].number;
+		bool regressed = change > options.tolerance && now.median - before["median"].number > noise;
+		bool improved = change < -options.tolerance && before["median"].number - now.median > noise;
+		regressions += regressed;
+
+		std::cerr << "  " << std::left << std::setw(20) << result.name << std::right << std::fixed
+			<< std::setprecision(3) << before["median"].number << " s -> " << now.median << " s  "
+			<< std::showpos << std::setprecision(1) << change << "%" << std::noshowpos
+			<< (regressed ? "  REGRESSION" : improved ? "  faster" : "");
+		if ((*previous)["image_hash"].text != hexHash(result.runs.front().imageHash))
+			std::cerr << "  (image changed)";
+		std::cerr << "\n";
+	}
+	std::cerr.unsetf(std::ios::floatfield);
+	return regressions;
+}
+
+static bool parsePositive(const char* text, int& value)
+{
+	char* end;
+	long number = std::strtol(text, &end, 10);
+	if (end == text || *end != '\0' || number <= 0 || number > 1 << 30) return false;
+	value = static_cast<int>(number);
+	return true;
+}
+
+static bool parseOptions(int argc, char* argv[], BenchOptions& options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "--help" || arg == "-h" || i + 1 >= argc)
+		{
+			std::cerr << usage;
+			return false;
+		}
+		const char* value = argv[++i];
+
+		bool ok = true;
+		if (arg == "--scenes")
+		{
+			std::stringstream list(value);
+			std::string scene;
+			options.scenes.clear();
+			while (std::getline(list, scene, ','))
+			{
+				// Numbers must select one of the sample scenes
+				char* numberEnd;
+				long number = std::strtol(scene.c_str(), &numberEnd, 10);
+				if (*numberEnd == '\0' && numberEnd != scene.c_str() && !SceneParser::sampleScene(number))
+					ok = false;
+				options.scenes.push_back(scene);
+			}
+			ok = ok && !options.scenes.empty();
+		}
+		else if (arg == "--resolution") ok = parsePositive(value, options.width);
+		else if (arg == "--spp") ok = parsePositive(value, options.samplesPerPixel);
+		else if (arg == "--depth") ok = parsePositive(value, options.maxDepth);
+		else if (arg == "--threads") ok = parsePositive(value, options.threads);
+		else if (arg == "--repeat") ok = parsePositive(value, options.repeat);
+		else if (arg == "--warmup")
+		{
+			options.warmup = std::atoi(value);
+			ok = options.warmup >= 0;
+		}
+		else if (arg == "--seed")
+		{
+			char* end;
+			unsigned long number = std::strtoul(value, &end, 10);
+			ok = end != value && *end == '\0' && number <= 0xFFFFFFFFul;
+			options.seed = static_cast<uint32_t>(number);
+		}
+		else if (arg == "--bvh")
+		{
+			options.bvhName = value;
+			if (options.bvhName == "median") options.bvh = BVHBuilder::Median;
+			else if (options.bvhName == "sah") options.bvh = BVHBuilder::SAH;
+			else if (options.bvhName == "none") options.bvh = BVHBuilder::None;
+			else ok = false;
+		}
+		else if (arg == "--format")
+		{
+			options.format = value;
+			ok = options.format == "png" || options.format == "hdr"
+				|| options.format == "pfm" || options.format == "exr";
+		}
+		else if (arg == "--json") options.jsonFile = value;
+		else if (arg == "--baseline") options.baselineFile = value;
+		else if (arg == "--tolerance")
+		{
+			options.tolerance = std::atof(value);
+			ok = options.tolerance >= 0.0;
+		}
+		else
+		{
+			std::cerr << "Unknown option " << arg << ".\n" << usage;
+			return false;
+		}
+
+		if (!ok)
+		{
+			std::cerr << "Invalid value '" << value << "' for " << arg << ".\n";
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	BenchOptions options;
+	for (int i = 1; i <= SceneParser::sampleSceneCount; i++)
+		options.scenes.push_back(std::to_string(i));
+	if (!parseOptions(argc, argv, options))
+		return 1;
+
+	Json::Value baseline;
+	if (!options.baselineFile.empty() && !Json::Reader::load(options.baselineFile, baseline))
+	{
+		std::cerr << "ERROR: Could not read baseline '" << options.baselineFile << "'.\n";
+		return 1;
+	}
+
+	std::vector<SceneResult> results;
+	for (const auto& scene : options.scenes)
+	{
+		// Numbers select the sample scenes
+		std::string file = scene;
+		char* numberEnd;
+		long number = std::strtol(scene.c_str(), &numberEnd, 10);
+		if (*numberEnd == '\0' && numberEnd != scene.c_str())
+			file = SceneParser::sampleScene(number);
+
+		SceneResult result;
+		result.name = sceneName(file);
+		if (SceneParser::resolve(file).empty())
+		{
+			std::cerr << "ERROR: Could not find scene file '" << file << "'.\n";
+			result.failed = true;
+			results.push_back(result);
+			continue;
+		}
+		std::cerr << "Benchmarking " << result.name << std::flush;
+
+		Run run;
+		for (int i = 0; i < options.warmup + options.repeat && !result.failed; i++)
+		{
+			result.failed = !runScene(file, options, run, result.width, result.height);
+			if (i >= options.warmup && !result.failed)
+				result.runs.push_back(run);
+			std::cerr << "." << std::flush;
+		}
+
+		if (result.failed)
+			std::cerr << " failed\n";
+		else
+		{
+			Summary render = summarizeRuns(result.runs, renderTime);
+			Summary rays = summarizeRuns(result.runs, raysPerSecond);
+			std::cerr << " render " << std::fixed << std::setprecision(3) << render.median << " s +/- "
+				<< std::setprecision(1) << 100.0 * render.relativeError() << "%, "
+				<< std::setprecision(2) << rays.median / 1e6 << " Mrays/s\n";
+			std::cerr.unsetf(std::ios::floatfield);
+		}
+		results.push_back(result);
+	}
+
+	if (options.jsonFile.empty())
+		writeReport(std::cout, options, results);
+	else
+	{
+		std::ofstream file(options.jsonFile);
+		writeReport(file, options, results);
+		if (!file)
+		{
+			std::cerr << "ERROR: Could not write '" << options.jsonFile << "'.\n";
+			return 1;
+		}
+		std::cerr << "Report saved to " << options.jsonFile << "\n";
+	}
+
+	int regressions = baseline.isNull() ? 0 : compareBaseline(baseline, options, results);
+	for (const auto& result : results)
+	{
+		if (result.failed) return 1;
+	}
+	return regressions > 0 ? 2 : 0;
+}
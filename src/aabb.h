@@ -1,5 +1,7 @@
 #pragma once
 
+#include "stats.h"
+
 class AABB {
 public:
 	Interval x, y, z;
@@ -30,29 +32,15 @@ public:
 	}
 
 	bool hit(const Ray& ray, Interval rayT) const {
-		const Point3& rayOrigin = ray.origin;
-		const Vec3& rayDir = ray.dir;
-
-		for (int axis = 0; axis < 3; axis++) {
-			const Interval& ax = axisInterval(axis);
-			const float axDirInv = 1.0f / rayDir[axis];
-
-			float t0 = (ax.min - rayOrigin[axis]) * axDirInv;
-			float t1 = (ax.max - rayOrigin[axis]) * axDirInv;
-
-			if (t0 < t1) {
-				if (t0 > rayT.min) rayT.min = t0;
-				if (t1 < rayT.max) rayT.max = t1;
-			}
-			else {
-				if (t1 > rayT.min) rayT.min = t1;
-				if (t0 < rayT.min) rayT.max = t0;
-			}
-
-			if (rayT.max <= rayT.min) return false;
-		}
-
-		return true;
+		// Branchless slab test: the ray's sign bits select the near and far plane on each
+		// axis, so no comparison of the slab distances is needed. A zero direction component
+		// with the origin on a plane produces NaN, which leaves the interval unchanged.
+		Stats::aabbTest();
+		slab(x, ray.origin.x, ray.invDir.x, ray.sign[0], rayT);
+		slab(y, ray.origin.y, ray.invDir.y, ray.sign[1], rayT);
+		slab(z, ray.origin.z, ray.invDir.z, ray.sign[2], rayT);
+
+		return rayT.min < rayT.max;
 	}
 
 	int longestAxis() const {
@@ -64,9 +52,30 @@ public:
 		}
 	}
 
+	float surfaceArea() const {
+		return 2.0f * (x.size() * y.size() + y.size() * z.size() + z.size() * x.size());
+	}
+
+	// Box of an object moving linearly from box a to box b, at time t between them
+	static AABB lerp(const AABB& a, const AABB& b, float t) {
+		AABB box;
+		box.x = Interval(a.x.min + t * (b.x.min - a.x.min), a.x.max + t * (b.x.max - a.x.max));
+		box.y = Interval(a.y.min + t * (b.y.min - a.y.min), a.y.max + t * (b.y.max - a.y.max));
+		box.z = Interval(a.z.min + t * (b.z.min - a.z.min), a.z.max + t * (b.z.max - a.z.max));
+		return box;
+	}
+
 	static const AABB Empty, Universe;
 
 private:
+	static void slab(const Interval& ax, float origin, float invDir, int sign, Interval& rayT)
+	{
+		float tNear = ((sign ? ax.max : ax.min) - origin) * invDir;
+		float tFar = ((sign ? ax.min : ax.max) - origin) * invDir;
+		rayT.min = tNear > rayT.min ? tNear : rayT.min;
+		rayT.max = tFar < rayT.max ? tFar : rayT.max;
+	}
+
 	void padToMinimums()
 	{
 		float delta = 0.0001f;
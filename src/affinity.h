@@ -0,0 +1,144 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// CPUs the process may run on, grouped by NUMA node, and pinning threads to them. Nodes are
+// read from sysfs on Linux; elsewhere, or without sysfs, all CPUs form one node and pinning
+// is unavailable.
+class CpuTopology
+{
+public:
+	std::vector<std::vector<int>> nodes;	// CPU ids of each node with any usable CPU
+
+	static CpuTopology detect()
+	{
+		CpuTopology topology;
+		std::vector<int> allowed = allowedCpus();
+
+#ifdef __linux__
+		std::string online;
+		readLine("/sys/devices/system/node/online", online);
+		for (int node : parseList(online))
+		{
+			std::string list;
+			if (!readLine("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist", list))
+				continue;
+
+			std::vector<int> cpus;
+			for (int cpu : parseList(list))
+			{
+				if (std::find(allowed.begin(), allowed.end(), cpu) != allowed.end())
+					cpus.push_back(cpu);
+			}
+			if (!cpus.empty()) topology.nodes.push_back(cpus);
+		}
+#endif
+
+		if (topology.nodes.empty())
+			topology.nodes.push_back(allowed);
+		return topology;
+	}
+
+	int nodeCount() const { return static_cast<int>(nodes.size()); }
+
+	// Spreads threads over the nodes in turn, then over the CPUs of each node
+	int nodeOf(int thread) const { return thread % nodeCount(); }
+
+	int cpuOf(int thread) const
+	{
+		const std::vector<int>& cpus = nodes[nodeOf(thread)];
+		return cpus[(thread / nodeCount()) % cpus.size()];
+	}
+
+	static bool pinningSupported()
+	{
+#ifdef __linux__
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	// Pins the calling thread to one CPU; returns false where pinning is unavailable
+	static bool pin(int cpu)
+	{
+#ifdef __linux__
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+		(void)cpu;
+		return false;
+#endif
+	}
+
+private:
+	static std::vector<int> allowedCpus()
+	{
+		std::vector<int> cpus;
+#ifdef __linux__
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		if (sched_getaffinity(0, sizeof(set), &set) == 0)
+		{
+			for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+			{
+				if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+			}
+		}
+#endif
+		if (cpus.empty())
+		{
+			int count = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+			for (int cpu = 0; cpu < count; cpu++)
+				cpus.push_back(cpu);
+		}
+		return cpus;
+	}
+
+	static bool readLine(const std::string& path, std::string& line)
+	{
+		std::FILE* file = std::fopen(path.c_str(), "r");
+		if (!file) return false;
+		char buffer[4096];
+		bool ok = std::fgets(buffer, sizeof(buffer), file) != nullptr;
+		std::fclose(file);
+		if (ok) line = buffer;
+		return ok;
+	}
+
+	// Parses a CPU list such as "0-3,8-11"
+	static std::vector<int> parseList(const std::string& list)
+	{
+		std::vector<int> cpus;
+		const char* cursor = list.c_str();
+		while (*cursor)
+		{
+			int first, last, length;
+			if (std::sscanf(cursor, "%d-%d%n", &first, &last, &length) == 2)
+				cursor += length;
+			else if (std::sscanf(cursor, "%d%n", &first, &length) == 1)
+			{
+				last = first;
+				cursor += length;
+			}
+			else
+				break;
+
+			for (int cpu = first; cpu <= last; cpu++)
+				cpus.push_back(cpu);
+			if (*cursor == ',') cursor++;
+		}
+		return cpus;
+	}
+};
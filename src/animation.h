@@ -0,0 +1,52 @@
+#pragma once
+
+#include "bvh.h"
+#include "scene_parser.h"
+#include "timing.h"
+
+#include <memory>
+
+// Poses a scene's animated objects frame by frame. Between frames the BVH keeps its shape
+// and only refits its bounds, which costs one pass over the nodes instead of a full build.
+// Refitted trees loosen as objects drift from where the build placed them, so the BVH is
+// rebuilt once its nodes have grown, on average, past rebuildThreshold times the surface
+// area each had when it was built.
+class Animator
+{
+public:
+	float rebuildThreshold = 1.3f;
+
+	Animator(Scene& scene, BVHBuilder builder) : scene(scene), builder(builder) {}
+
+	void setTime(float time)
+	{
+		{
+			ScopedTimer timer("BVH refit");
+			scene.world.update(time);
+		}
+
+		if (growth() > rebuildThreshold)
+		{
+			ScopedTimer timer("BVH rebuild");
+			HittableRegistry::Scope registryScope(scene.registry);
+			std::vector<std::shared_ptr<Hittable>> objects = scene.objects;
+			scene.world = HittableList(std::make_shared<BVHNode>(objects, 0, objects.size(), builder));
+			rebuildCount++;
+		}
+	}
+
+	int rebuilds() const { return rebuildCount; }
+
+private:
+	Scene& scene;
+	BVHBuilder builder;
+	int rebuildCount = 0;
+
+	// Growth of the scene's BVH since it was built, or 1 without one
+	float growth() const
+	{
+		if (scene.world.objects.size() != 1) return 1.0f;
+		auto root = dynamic_cast<const BVHNode*>(scene.world.objects[0].get());
+		return root ? root->growth() : 1.0f;
+	}
+};
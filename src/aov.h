@@ -0,0 +1,176 @@
+#pragma once
+
+#include "hittable.h"
+#include "material.h"
+#include "timing.h"
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Arbitrary output variables: per-pixel images besides the final color, filled in from
+// the first hit of each camera sample. Ids and counts are stored as floats, which are
+// exact up to 2^24; misses have an id of -1 and infinite depth. Variance is that of the
+// pixel's mean luminance, estimated from its samples.
+enum class Aov
+{
+	Albedo,
+	Normal,
+	Depth,
+	PrimitiveId,
+	MaterialId,
+	SampleCount,
+	Time,
+	Variance,
+	Count
+};
+
+const int aovCount = static_cast<int>(Aov::Count);
+
+inline unsigned aovBit(Aov aov) { return 1u << static_cast<int>(aov); }
+
+inline const char* aovName(Aov aov)
+{
+	static const char* names[] = { "albedo", "normal", "depth", "primid", "matid", "samples", "time", "variance" };
+	return names[static_cast<int>(aov)];
+}
+
+// Parses a comma separated list of AOV names, or "all", into a bit mask. Returns false on
+// an unknown name.
+inline bool parseAovs(const std::string& list, unsigned& mask)
+{
+	std::stringstream stream(list);
+	std::string name;
+	while (std::getline(stream, name, ','))
+	{
+		if (name == "all")
+		{
+			mask |= (1u << aovCount) - 1;
+			continue;
+		}
+
+		bool found = false;
+		for (int i = 0; i < aovCount && !found; i++)
+		{
+			if (name == aovName(static_cast<Aov>(i)))
+			{
+				mask |= aovBit(static_cast<Aov>(i));
+				found = true;
+			}
+		}
+		if (!found) return false;
+	}
+	return true;
+}
+
+// AOV images of one tile, in the tile's scanline order
+struct AovTile
+{
+	std::vector<Color> layers[aovCount];
+
+	AovTile(int pixelCount)
+	{
+		for (auto& layer : layers)
+			layer.resize(pixelCount);
+	}
+};
+
+// The render loop is instantiated once per specialization, so renders without AOVs carry
+// no recording code at all.
+template <bool Enabled>
+class AovRecorder;
+
+template <>
+class AovRecorder<false>
+{
+public:
+	AovRecorder(AovTile*) {}
+
+	void beginPixel() {}
+	void hit(const Ray&, const RayHit&, const HitRecord&) {}
+	void miss(const Color&) {}
+	void sample(const Color&) {}
+	void endPixel(int) {}
+};
+
+template <>
+class AovRecorder<true>
+{
+public:
+	AovRecorder(AovTile* tile) : tile(tile) {}
+
+	void beginPixel()
+	{
+		albedo = normal = Vec3(0.0f, 0.0f, 0.0f);
+		samples = 0;
+		luminanceSum = luminanceSquaredSum = 0.0;
+		start = Timings::Clock::now();
+	}
+
+	void hit(const Ray& ray, const RayHit& rayHit, const HitRecord& record)
+	{
+		// Albedo and normal are averaged over the samples; the rest come from the first one
+		albedo += record.mat->baseColor(record);
+		normal += record.normal;
+		if (samples++ == 0)
+		{
+			depth = rayHit.t * mag(ray.dir);
+			primId = static_cast<float>(rayHit.primId);
+			matId = static_cast<float>(record.mat->id());
+		}
+	}
+
+	void miss(const Color& background)
+	{
+		albedo += background;
+		if (samples++ == 0)
+		{
+			depth = infinity;
+			primId = matId = -1.0f;
+		}
+	}
+
+	void sample(const Color& radiance)
+	{
+		double luminance = 0.2126 * radiance.x + 0.7152 * radiance.y + 0.0722 * radiance.z;
+		luminanceSum += luminance;
+		luminanceSquaredSum += luminance * luminance;
+	}
+
+	void endPixel(int index)
+	{
+		float scale = samples > 0 ? 1.0f / samples : 0.0f;
+
+		float variance = 0.0f;
+		if (samples > 1)
+		{
+			double mean = luminanceSum / samples;
+			double sampleVariance = (luminanceSquaredSum - samples * mean * mean) / (samples - 1);
+			variance = static_cast<float>(std::max(sampleVariance, 0.0) / samples);
+		}
+
+		float time = static_cast<float>(Timings::seconds(start, Timings::Clock::now()));
+
+		tile->layers[static_cast<int>(Aov::Albedo)][index] = scale * albedo;
+		tile->layers[static_cast<int>(Aov::Normal)][index] = scale * normal;
+		tile->layers[static_cast<int>(Aov::Depth)][index] = Color(depth, depth, depth);
+		tile->layers[static_cast<int>(Aov::PrimitiveId)][index] = Color(primId, primId, primId);
+		tile->layers[static_cast<int>(Aov::MaterialId)][index] = Color(matId, matId, matId);
+		tile->layers[static_cast<int>(Aov::SampleCount)][index] = Color(float(samples), float(samples), float(samples));
+		tile->layers[static_cast<int>(Aov::Time)][index] = Color(time, time, time);
+		tile->layers[static_cast<int>(Aov::Variance)][index] = Color(variance, variance, variance);
+	}
+
+private:
+	AovTile* tile;
+	Color albedo;
+	Vec3 normal;
+	float depth = infinity;
+	float primId = -1.0f;
+	float matId = -1.0f;
+	int samples = 0;
+	double luminanceSum = 0.0;
+	double luminanceSquaredSum = 0.0;
+	Timings::Clock::time_point start;
+};
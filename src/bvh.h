@@ -6,11 +6,22 @@
 
 #include <algorithm>
 
+// How a BVH chooses where to split its nodes
+enum class BVHBuilder {
+	None,		// No BVH: rays test every top level object
+	Median,		// Sort along the longest axis and split at the median object
+	SAH			// Binned surface area heuristic: slower to build, faster to trace
+};
+
 class BVHNode : public Hittable {
 public:
-	BVHNode(HittableList& list) : BVHNode(list.objects, 0, list.objects.size()) {}
+	BVHNode(HittableList& list, BVHBuilder builder = BVHBuilder::Median)
+		: BVHNode(list.objects, 0, list.objects.size(), builder) {}
 
-	BVHNode(std::vector<std::shared_ptr<Hittable>>& objects, size_t start, size_t end) {
+	BVHNode(
+		std::vector<std::shared_ptr<Hittable>>& objects, size_t start, size_t end,
+		BVHBuilder builder = BVHBuilder::Median
+	) {
 		bbox = AABB::Empty;
 		for (size_t i = start; i < end; i++) {
 			bbox = AABB(bbox, objects[i]->boundingBox());
@@ -18,7 +29,7 @@ public:
 
 		int axis = bbox.longestAxis();
 
-		auto comparator = [&axis](const auto& a, const auto& b) {
+		auto comparator = [&axis](const std::shared_ptr<Hittable>& a, const std::shared_ptr<Hittable>& b) {
 			return boxCompare(a, b, axis);
 			};
 
@@ -32,29 +43,199 @@ public:
 			right = objects[start + 1];
 		}
 		else {
-			std::sort(std::begin(objects) + start, std::begin(objects) + end, comparator);
+			size_t mid;
+			if (builder != BVHBuilder::SAH || !sahSplit(objects, start, end, mid)) {
+				std::sort(std::begin(objects) + start, std::begin(objects) + end, comparator);
+				mid = start + objectSpan / 2;
+			}
 
-			auto mid = start + objectSpan / 2;
-			left = std::make_shared<BVHNode>(objects, start, mid);
-			right = std::make_shared<BVHNode>(objects, mid, end);
+			left = std::make_shared<BVHNode>(objects, start, mid, builder);
+			right = std::make_shared<BVHNode>(objects, mid, end, builder);
 		}
+
+		containsInstances = left->hasInstances() || right->hasInstances();
+		setMotionBounds();
+		builtArea = bbox.surfaceArea();
 	}
 
-	bool hit(const Ray& ray, Interval rayT, HitRecord& record) const override {
-		if (!bbox.hit(ray, rayT)) return false;
+	bool hit(const Ray& ray, Interval rayT, RayHit& rayHit) const override {
+		// Nodes over moving objects test the box at the ray's time rather than the box
+		// enclosing the whole shutter interval. A node counts as visited once the ray enters
+		// its box; the box test itself counts as an AABB test.
+		if (moving ? !AABB::lerp(startBox, endBox, ray.time).hit(ray, rayT) : !bbox.hit(ray, rayT)) {
+			return false;
+		}
+		Stats::nodeVisit();
 		
-		bool hitLeft = left->hit(ray, rayT, record);
-		bool hitRight = right->hit(ray, Interval(rayT.min, hitLeft ? record.t : rayT.max), record);
+		bool hitLeft = left->hit(ray, rayT, rayHit);
+		bool hitRight = right->hit(ray, Interval(rayT.min, hitLeft ? rayHit.t : rayT.max), rayHit);
 		
 		return hitLeft || hitRight;
 	}
 
+	void surface(const Ray& ray, const RayHit& rayHit, HitRecord& record) const override {
+		if (!containsInstances) {
+			Hittable::surface(ray, rayHit, record);
+			return;
+		}
+
+		if (!surfaceFromChild(*left, ray, rayHit, record))
+			surfaceFromChild(*right, ray, rayHit, record);
+	}
+
+	bool hasInstances() const override { return containsInstances; }
+
+	const HittableRegistry& registry() const override { return *objectRegistry; }
+
+	// Refits the bounds bottom up; the tree keeps its shape, so it may loosen as objects move
+	bool update(float time) override {
+		bool changed = left->update(time);
+		if (right != left) {
+			changed = right->update(time) || changed;
+		}
+		if (changed) {
+			bbox = AABB(left->boundingBox(), right->boundingBox());
+			setMotionBounds();
+		}
+		return changed;
+	}
+
+	std::shared_ptr<Hittable> replicate(Replicas& replicas) const override {
+		auto copy = std::make_shared<BVHNode>(*this);
+		copy->left = replicateChild(left, replicas);
+		copy->right = replicateChild(right, replicas);
+		return copy;
+	}
+
+	void motionBounds(AABB& start, AABB& end) const override {
+		start = startBox;
+		end = endBox;
+	}
+
+	// How far refits have loosened the tree: the mean over its nodes of each node's surface
+	// area relative to its area when it was built. 1 for a fresh build. Each node is measured
+	// against itself, so a large static object near the root does not hide nodes below it
+	// that grow as their objects drift apart.
+	float growth() const {
+		double sum = 0.0;
+		int count = 0;
+		addGrowth(sum, count);
+		return count > 0 ? static_cast<float>(sum / count) : 1.0f;
+	}
+
 	AABB boundingBox() const override { return bbox; }
 
 private:
 	std::shared_ptr<Hittable> left;
 	std::shared_ptr<Hittable> right;
 	AABB bbox;
+	AABB startBox, endBox;				// Bounds at both ends of the shutter
+	bool moving;						// Whether they differ
+	bool containsInstances;
+	float builtArea;					// Surface area when built, before any refit
+	std::shared_ptr<HittableRegistry> objectRegistry = HittableRegistry::current();
+
+	void setMotionBounds() {
+		AABB leftStart, leftEnd, rightStart, rightEnd;
+		left->motionBounds(leftStart, leftEnd);
+		right->motionBounds(rightStart, rightEnd);
+		startBox = AABB(leftStart, rightStart);
+		endBox = AABB(leftEnd, rightEnd);
+		moving = !same(startBox.x, endBox.x) || !same(startBox.y, endBox.y) || !same(startBox.z, endBox.z);
+	}
+
+	static bool same(const Interval& a, const Interval& b) {
+		return a.min == b.min && a.max == b.max;
+	}
+
+	void addGrowth(double& sum, int& count) const {
+		// Nodes without area, such as over a single point, cannot grow by a ratio
+		if (builtArea > 0.0f) {
+			sum += bbox.surfaceArea() / builtArea;
+			count++;
+		}
+		auto leftNode = dynamic_cast<const BVHNode*>(left.get());
+		auto rightNode = dynamic_cast<const BVHNode*>(right.get());
+		if (leftNode) leftNode->addGrowth(sum, count);
+		if (rightNode && right != left) rightNode->addGrowth(sum, count);
+	}
+
+	static float centroid(const std::shared_ptr<Hittable>& object, int axis) {
+		Interval interval = object->boundingBox().axisInterval(axis);
+		return 0.5f * (interval.min + interval.max);
+	}
+
+	static bool sahSplit(
+		std::vector<std::shared_ptr<Hittable>>& objects, size_t start, size_t end, size_t& mid
+	) {
+		// Bin the objects by centroid along the axis where the centroids spread the most, then
+		// pick the bin boundary with the lowest summed area times object count of both sides.
+		// Returns false when no finite split separates the centroids.
+		const int binCount = 12;
+
+		float low[3] = { infinity, infinity, infinity };
+		float high[3] = { -infinity, -infinity, -infinity };
+		for (size_t i = start; i < end; i++) {
+			for (int a = 0; a < 3; a++) {
+				float c = centroid(objects[i], a);
+				low[a] = std::min(low[a], c);
+				high[a] = std::max(high[a], c);
+			}
+		}
+
+		int axis = 0;
+		for (int a = 1; a < 3; a++) {
+			if (high[a] - low[a] > high[axis] - low[axis]) axis = a;
+		}
+		float extent = high[axis] - low[axis];
+		if (!(extent > 0.0f && extent < infinity)) return false;
+
+		auto binOf = [&](const std::shared_ptr<Hittable>& object) {
+			int bin = static_cast<int>(binCount * (centroid(object, axis) - low[axis]) / extent);
+			return std::min(bin, binCount - 1);
+		};
+
+		AABB binBounds[binCount];
+		int binObjects[binCount] = {};
+		std::fill(binBounds, binBounds + binCount, AABB::Empty);
+		for (size_t i = start; i < end; i++) {
+			int bin = binOf(objects[i]);
+			binBounds[bin] = AABB(binBounds[bin], objects[i]->boundingBox());
+			binObjects[bin]++;
+		}
+
+		// Sweep from the right to get the cost of everything above each boundary
+		float rightCost[binCount];
+		AABB bounds = AABB::Empty;
+		int count = 0;
+		for (int bin = binCount - 1; bin > 0; bin--) {
+			bounds = AABB(bounds, binBounds[bin]);
+			count += binObjects[bin];
+			rightCost[bin] = count > 0 ? count * bounds.surfaceArea() : 0.0f;
+		}
+
+		int bestBin = -1;
+		float bestCost = infinity;
+		bounds = AABB::Empty;
+		count = 0;
+		for (int bin = 0; bin < binCount - 1; bin++) {
+			bounds = AABB(bounds, binBounds[bin]);
+			count += binObjects[bin];
+			if (count == 0 || count == static_cast<int>(end - start)) continue;
+
+			float cost = count * bounds.surfaceArea() + rightCost[bin + 1];
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestBin = bin;
+			}
+		}
+		if (bestBin < 0) return false;
+
+		auto split = std::partition(std::begin(objects) + start, std::begin(objects) + end,
+			[&](const std::shared_ptr<Hittable>& object) { return binOf(object) <= bestBin; });
+		mid = split - std::begin(objects);
+		return true;
+	}
 
 	static bool boxCompare(
 		const std::shared_ptr<Hittable>& a, const std::shared_ptr<Hittable>& b, int axis
@@ -1,28 +1,84 @@
 #pragma once
 
+#include "affinity.h"
+#include "aov.h"
+#include "denoiser.h"
+#include "frame_buffer.h"
 #include "hittable.h"
+#include "image_writer.h"
 #include "material.h"
+#include "render_metrics.h"
+#include "timing.h"
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
+#include <atomic>
+#include <condition_variable>
 #include <thread>
 #include <mutex>
 
+static_assert(sizeof(Color) == 3 * sizeof(float), "Color must be three packed floats");
+
+// What each camera sample computes
+enum class Integrator
+{
+	Path,		// Path tracing with each material's scattering
+	Normals		// Shading normal of the first hit, for checking geometry and timing traversal
+};
+
 struct Tile
 {
 	int x0, y0, x1, y1;
 };
 
-class Camera 
+class Camera;
+
+// Renders some of a camera's tiles elsewhere, e.g. in other processes. Camera::render runs
+// it on a thread of its own next to the render threads; it takes tiles from the camera and
+// hands back their pixels, or the tiles themselves if it cannot finish them.
+class TileFarm
 {
 public:
+	virtual ~TileFarm() {}
+	virtual void run(Camera& camera) = 0;
+};
+
+// What a camera renders and how. Kept apart from the camera's render state, so that a
+// scene's settings can be copied and overridden for each render.
+struct CameraSettings
+{
 	float aspectRatio = 1.0f;
 	int imageWidth = 100;
+	int fixedHeight = 0;				// Image height, or 0 to derive it from aspectRatio
 	int samplesPerPixel = 10;
 	int maxDepth = 10;
 	Color background;
 	int tileSize = 16;
+	int threadCount = 0;				// Render threads, or 0 for one per hardware thread
+
+	// Pin each render thread to a CPU, spreading them over the NUMA nodes. With more than
+	// one node, each node gets its own copy of the scene and prefers tiles from its own band
+	// of the image, whose framebuffer pages its threads then touch first.
+	bool pinThreads = false;
+	Integrator integrator = Integrator::Path;
+	uint32_t seed = 0;					// Each tile's samples are seeded from this and its position
+	std::string outputFile = "output.png";	// .png, or .hdr, .pfm, .exr for linear float output
+
+	// Write tiles to the output file as they finish instead of keeping the whole image in
+	// memory. Needs a .hdr, .pfm or .exr output file.
+	bool streamOutput = false;
+
+	// AOV images to write next to the output, as a mask of aovBit() values. Each goes to a
+	// float image named after the output file, e.g. output.albedo.exr.
+	unsigned aovs = 0;
+
+	// Filter the finished image guided by the albedo, normal and variance AOVs, for low
+	// sample count previews. Not available when streaming.
+	bool denoise = false;
+
+	// Show the tiles remaining on the console while rendering
+	bool showProgress = true;
 
 	float vFov = 90.0f;
 	Point3 lookFrom = Point3(0.0f, 0.0f, 0.0f);
@@ -31,46 +87,165 @@ public:
 
 	float defocusAngle = 0.0f;
 	float focusDist = 1.0f;
+};
 
+class Camera : public CameraSettings
+{
+public:
 	void render(const Hittable& world) 
 	{
-		initialize();
+		metrics->setPhase(RenderMetrics::Phase::Setup);
+		{
+			// Image textures may still be decoding in the background
+			ScopedTimer timer("Texture wait");
+			TextureLoader::wait();
+		}
+
+		std::unique_ptr<MetricsReporter> reporter;
+		{
+			ScopedTimer timer("Render");
+			int workerCount = threadCount > 0 ? threadCount : std::max(1u, std::thread::hardware_concurrency());
+			initializeNodes(workerCount);
+			initialize();
+
+			if (streamOutput && !openStreams())
+				return;
+
+			// Tiles from the farm are counted as one more worker
+			metrics->begin(static_cast<int>(queuedTiles()), static_cast<uint64_t>(imageWidth) * imageHeight,
+				workerCount + (farm ? 1 : 0));
+			if (showProgress)
+				reporter.reset(new MetricsReporter(*metrics, MetricsReporter::Options()));
+
+			if (recordedAovs)
+				renderTiles<true>(world, workerCount);
+			else
+				renderTiles<false>(world, workerCount);
+			metrics->end();
+		}
 
-#define useMT 1
-#if useMT
-		// Create a thread pool to render tiles in parallel
-		int threadCount = std::thread::hardware_concurrency();
-		std::vector<std::thread> threads;
-		std::cout << "Available threads: " << threadCount << " \n";
+		if (reporter) reporter->stop();
+		std::clog << "\rDone.                 \n";
 
-		for (int i = 0; i < threadCount; i++)
+		if (Stats::enabled)
 		{
-			threads.emplace_back(&Camera::renderWorker, this, std::ref(world));
+			traversal.print(std::clog);
+			writeHeatmap(outputStem() + ".cost.png");
 		}
 
-		// Wait for all threads to finish rendering
-		for (auto& t : threads)
-			t.join();
+		if (denoise && !streamOutput)
+		{
+			Denoiser denoiser;
+			denoiser.threadCount = threadCount;
+			std::vector<Color> pixels = frame.pixels();
+			denoiser.denoise(imageWidth, imageHeight, pixels,
+				aovImages[static_cast<int>(Aov::Albedo)], aovImages[static_cast<int>(Aov::Normal)],
+				aovImages[static_cast<int>(Aov::Variance)]);
+			frame.assign(pixels);
+		}
 
-#else
-		for (int i = 0; i < tileQueue.size(); i++)
+		ScopedTimer timer("Image write");
+		if (streamOutput)
+			closeStreams();
+		else
+			writeImages();
+	}
+
+	// Results of the last render. The image is empty when streaming.
+	std::vector<Color> image() const { return frame.pixels(); }
+	int height() const { return imageHeight; }
+	uint64_t cameraRays() const { return metrics->cameraRayCount(); }
+	uint64_t secondaryRays() const { return metrics->secondaryRayCount(); }
+	RenderMetrics::Snapshot progressSnapshot() const { return metrics->snapshot(); }
+
+	// Counts progress into metrics that outlive the render, such as those a program reports
+	// for its whole run, instead of the camera's own
+	void reportTo(RenderMetrics& shared) { metrics = &shared; }
+	const TraversalStats& traversalStats() const { return traversal; }
+
+	// Renders a share of the tiles during render() when set. Not used for AOVs or denoising,
+	// which need per-pixel data the farm does not return.
+	TileFarm* farm = nullptr;
+
+	// Tile exchange with the farm. A taken tile must be finished or returned.
+	bool takeTile(Tile& tile)
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		if (!popTile(0, tile)) return false;
+		farmTiles++;
+		return true;
+	}
+
+	void returnTile(const Tile& tile)
+	{
 		{
-			std::clog << "\rTiles remaining: " << (tileQueue.size() - i) << " " << std::flush;
-			renderTile(tileQueue[i], world);
+			std::lock_guard<std::mutex> lock(queueMutex);
+			tileQueues[queueOf(tile)].push_back(tile);
+			farmTiles--;
 		}
+		tileReturned.notify_all();
+	}
 
-#endif
-		std::clog << "\rDone.                 \n";
-		writePNG("output.png");
+	void finishTile(const Tile& tile, const std::vector<Color>& tilePixels, uint64_t secondaryRays)
+	{
+		storeTile(tile, tilePixels.data(), frame.row(0), frame.stride(), &stream);
+		uint64_t tilePixelCount = static_cast<uint64_t>(tile.x1 - tile.x0 + 1) * (tile.y1 - tile.y0 + 1);
+		metrics->tileDone(metrics->workerSlots() - 1, tilePixelCount, tilePixelCount * samplesPerPixel, secondaryRays,
+			Timings::Clock::duration::zero());
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			farmTiles--;
+		}
+		tileReturned.notify_all();
+	}
+
+	// True once every tile has been taken and none is out with the farm
+	bool tilesFinished()
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		return queuedTiles() == 0 && farmTiles == 0;
+	}
+
+	// Prepares to render single tiles for a farm, with settings matching the farm's camera
+	void beginRemoteTiles()
+	{
+		TextureLoader::wait();
+		initializeView();
+	}
+
+	// Renders one tile exactly as the farm's camera would, returning its secondary ray count
+	uint64_t renderRemoteTile(const Tile& tile, const Hittable& world, std::vector<Color>& tilePixels)
+	{
+		TraceScope trace("Tile", "render", "x", tile.x0, "y", tile.y0);
+		tilePixels.assign((tile.x1 - tile.x0 + 1) * (tile.y1 - tile.y0 + 1), Color(0.0f, 0.0f, 0.0f));
+		AovRecorder<false> recorder(nullptr);
+		uint64_t secondaryRays = 0;
+		shadeTile(tile, world, tilePixels.data(), recorder, secondaryRays);
+		return secondaryRays;
 	}
 
 private:
 	int imageHeight;
 	float pixelSamplesScale;			// Color scale factor for a sum of pixel samples
-	std::vector<Color> pixels;
-
-	std::vector<Tile> tileQueue;
+	float differentialScale;			// Ray differential offset in pixels
+	FrameBuffer frame;					// Whole image, unless streaming
+	ImageWriter::ImageStream stream;
+	std::vector<Color> aovImages[aovCount];
+	std::unique_ptr<ImageWriter::ImageStream> aovStreams[aovCount];
+	unsigned recordedAovs;				// Written AOVs plus those the denoiser needs
+
+	CpuTopology topology;				// NUMA nodes in use, when pinning threads
+	std::vector<std::vector<Tile>> tileQueues;	// One per node, each a band of rows
 	std::mutex queueMutex;
+	std::condition_variable tileReturned;
+	int farmTiles = 0;					// Taken by the farm and not yet finished
+	RenderMetrics ownMetrics;
+	RenderMetrics* metrics = &ownMetrics;
+
+	// Only filled when built with RAYTRACER_STATS
+	TraversalStats traversal;
+	std::mutex traversalMutex;
+	std::vector<float> costImage;		// Traversal cost per sample of each pixel
 
 	Point3 center;
 	Point3 pixel00Loc;
@@ -80,24 +255,99 @@ private:
 
 	void initialize() 
 	{
-		imageHeight = static_cast<int>(imageWidth / aspectRatio);
-		imageHeight = (imageHeight < 1) ? 1 : imageHeight;
-		pixels.resize(imageWidth * imageHeight, Color(0.0f, 0.0f, 0.0f));
+		initializeView();
+		recordedAovs = aovs;
+		traversal = TraversalStats();
+		if (Stats::enabled)
+			costImage.assign(imageWidth * imageHeight, 0.0f);
+		if (denoise && streamOutput)
+			std::cerr << "Denoising needs the whole image and is skipped when streaming\n";
+		else if (denoise)
+			recordedAovs |= aovBit(Aov::Albedo) | aovBit(Aov::Normal) | aovBit(Aov::Variance);
+
+		if (!streamOutput)
+		{
+			frame.allocate(imageWidth, imageHeight);
+			for (int a = 0; a < aovCount; a++)
+			{
+				if (recordedAovs & aovBit(static_cast<Aov>(a)))
+					aovImages[a].resize(imageWidth * imageHeight, Color(0.0f, 0.0f, 0.0f));
+			}
+		}
 
 		// Tile the image into blocks for parallel processing
+		tileQueues.assign(topology.nodeCount(), std::vector<Tile>());
 		for (int j = 0; j < imageHeight; j += tileSize)
 		{
 			for (int i = 0; i < imageWidth; i += tileSize)
 			{
-				tileQueue.emplace_back(Tile{
+				Tile tile = {
 					i, j,
 					std::min(i + tileSize, imageWidth) - 1,
 					std::min(j + tileSize, imageHeight) - 1
-					});
+				};
+				tileQueues[queueOf(tile)].push_back(tile);
 			}
 		}
+	}
+
+	void initializeNodes(int workerCount)
+	{
+		// Without pinning all threads share one queue as if on one node
+		if (pinThreads && !CpuTopology::pinningSupported())
+		{
+			std::cerr << "Thread pinning is not available on this system\n";
+			pinThreads = false;
+		}
+		if (!pinThreads)
+		{
+			topology.nodes.assign(1, std::vector<int>());
+			return;
+		}
+
+		// Nodes without a render thread would only have their tiles stolen
+		topology = CpuTopology::detect();
+		if (topology.nodeCount() > workerCount)
+			topology.nodes.resize(workerCount);
+	}
+
+	// Node whose band of rows the tile is in
+	int queueOf(const Tile& tile) const
+	{
+		return static_cast<int>(static_cast<int64_t>(tile.y0) * tileQueues.size() / imageHeight);
+	}
+
+	// Called with queueMutex held
+	size_t queuedTiles() const
+	{
+		size_t count = 0;
+		for (const auto& queue : tileQueues)
+			count += queue.size();
+		return count;
+	}
+
+	// Takes a tile from the node's own queue, or from the next node with any left. Called
+	// with queueMutex held.
+	bool popTile(int node, Tile& tile)
+	{
+		for (size_t i = 0; i < tileQueues.size(); i++)
+		{
+			std::vector<Tile>& queue = tileQueues[(node + i) % tileQueues.size()];
+			if (queue.empty()) continue;
+			tile = queue.back();
+			queue.pop_back();
+			return true;
+		}
+		return false;
+	}
+
+	void initializeView()
+	{
+		imageHeight = fixedHeight > 0 ? fixedHeight : static_cast<int>(imageWidth / aspectRatio);
+		imageHeight = (imageHeight < 1) ? 1 : imageHeight;
 
 		pixelSamplesScale = 1.0f / samplesPerPixel;
+		differentialScale = std::fmax(0.125f, 1.0f / std::sqrt(static_cast<float>(samplesPerPixel)));
 
 		center = lookFrom;
 
@@ -131,7 +381,7 @@ private:
 		defocusDiskV = defocusRadius * v;
 	}
 
-	Ray getRay(int i, int j) const 
+	Ray getRay(int i, int j, RayDifferential& diff) const 
 	{
 		// Construct a camera ray originating from the defocus disk and driected at randomly
 		// sampled point around the pixel location i, j
@@ -144,6 +394,13 @@ private:
 		Vec3 rayDir = pixelSample - rayOrigin;
 		float rayTime = randomFloat();
 
+		// The differential rays pass through the neighbouring pixels from the same lens point.
+		// Each sample covers a fraction of the pixel, so the offsets shrink with the sample
+		// count to avoid blurring textures twice.
+		diff.rxOrigin = diff.ryOrigin = rayOrigin;
+		diff.rxDir = rayDir + differentialScale * pixelDeltaU;
+		diff.ryDir = rayDir + differentialScale * pixelDeltaV;
+
 		return Ray(rayOrigin, rayDir, rayTime);
 	}
 
@@ -160,81 +417,401 @@ private:
 		return center + p.x * defocusDiskU + p.y * defocusDiskV;
 	}
 
-	Color rayColor(const Ray& ray, int depth, const Hittable& world) const 
+	template <bool RecordAovs>
+	Color rayColor(
+		const Ray& ray, int depth, const Hittable& world, const RayDifferential* diff,
+		AovRecorder<RecordAovs>& recorder, uint64_t& secondaryRays
+	) const 
 	{
 		// If the ray bounce limit is exceeded, no more light is gathered
 		if (depth <= 0) {
+			Stats::pathEnd(Termination::MaxDepth, maxDepth);
 			return Color(0.0f, 0.0f, 0.0f);
 		}
 
-		HitRecord record;
+		// Only camera rays carry differentials
+		if (!diff)
+			secondaryRays++;
+
+		Stats::ray();
+		RayHit rayHit;
 
 		// If the ray hits noting, return the background color
-		if (!world.hit(ray, Interval(0.001f, infinity), record))
+		if (!world.hit(ray, Interval(0.001f, infinity), rayHit))
+		{
+			Stats::pathEnd(Termination::Miss, maxDepth - depth + 1);
+			recorder.miss(background);
 			return background;
+		}
+
+		// Reconstruct the full surface interaction only for the closest hit
+		HitRecord record;
+		world.surfaceInteraction(ray, rayHit, record);
+
+		// Camera rays carry differentials that size the texture filter; scattered rays
+		// sample textures unfiltered
+		if (diff)
+			record.setFilterWidth(*diff);
+
+		recorder.hit(ray, rayHit, record);
 
 		Ray scattered;
 		Color attenuation;
-		Color emissionColor = record.mat->emitted(record.u, record.v, record.p);
+		Color emissionColor = record.mat->isEmissive()
+			? record.mat->emitted(record.u, record.v, record.p) : Color(0.0f, 0.0f, 0.0f);
 		
 		if (!record.mat->scatter(ray, record, attenuation, scattered))
+		{
+			Stats::pathEnd(record.mat->isEmissive() ? Termination::Emitted : Termination::Absorbed,
+				maxDepth - depth + 1);
 			return emissionColor;
+		}
 		
-		// If the ray is scattered, recursively gather light from the new ray
-		Color scatterColor = attenuation * rayColor(scattered, depth - 1, world);
+		// If the ray is scattered, recursively gather light from the new ray. AOVs only
+		// describe the first hit.
+		AovRecorder<false> noAovs(nullptr);
+		Color scatterColor = attenuation * rayColor(scattered, depth - 1, world, nullptr, noAovs, secondaryRays);
 		return emissionColor + scatterColor;
 	}
 
-	void renderWorker(const Hittable& world)
+	template <bool RecordAovs>
+	Color normalColor(
+		const Ray& ray, const Hittable& world, const RayDifferential* diff,
+		AovRecorder<RecordAovs>& recorder
+	) const
+	{
+		Stats::ray();
+		RayHit rayHit;
+		if (!world.hit(ray, Interval(0.001f, infinity), rayHit))
+		{
+			recorder.miss(background);
+			return background;
+		}
+
+		HitRecord record;
+		world.surfaceInteraction(ray, rayHit, record);
+		if (diff)
+			record.setFilterWidth(*diff);
+
+		recorder.hit(ray, rayHit, record);
+		return 0.5f * (record.normal + Color(1.0f, 1.0f, 1.0f));
+	}
+
+	template <bool RecordAovs>
+	void renderTiles(const Hittable& world, int workerCount)
 	{
-		// Continuously render the next tile from the queue
+		std::cout << "Render threads: " << workerCount;
+		if (pinThreads)
+			std::cout << ", pinned over " << topology.nodeCount() << " NUMA node" << (topology.nodeCount() > 1 ? "s" : "");
+		std::cout << " \n";
+
+		// Each node traverses a copy of the scene made by a thread pinned to it, so that the
+		// copy is allocated in the node's local memory
+		std::vector<std::shared_ptr<Hittable>> replicas(topology.nodeCount());
+		if (topology.nodeCount() > 1)
+		{
+			ScopedTimer timer("Scene replicate");
+			std::vector<std::thread> copiers;
+			for (int node = 0; node < topology.nodeCount(); node++)
+			{
+				copiers.emplace_back([this, &world, &replicas, node]() {
+					CpuTopology::pin(topology.nodes[node].front());
+					Hittable::Replicas copied;
+					replicas[node] = world.replicate(copied);
+				});
+			}
+			for (auto& copier : copiers)
+				copier.join();
+		}
+
+		// The farm takes tiles from the same queue as the render threads
+		std::thread farmThread;
+		if (farm)
+		{
+			farmThread = std::thread([this]() {
+				Trace::instance().setThreadName("Tile farm");
+				farm->run(*this);
+			});
+		}
+
+		// A single unpinned thread renders on the calling thread
+		if (workerCount == 1 && !pinThreads)
+			renderWorker<RecordAovs>(world, 0, 0);
+		else
+		{
+			// Create a thread pool to render tiles in parallel
+			std::vector<std::thread> threads;
+			for (int i = 0; i < workerCount; i++)
+			{
+				threads.emplace_back([this, &world, &replicas, i]() {
+					Trace::instance().setThreadName("Render worker " + std::to_string(i));
+					int node = 0;
+					if (pinThreads)
+					{
+						CpuTopology::pin(topology.cpuOf(i));
+						node = topology.nodeOf(i);
+					}
+					renderWorker<RecordAovs>(replicas[node] ? *replicas[node] : world, i, node);
+				});
+			}
+
+			// Wait for all threads to finish rendering
+			for (auto& t : threads)
+				t.join();
+		}
+
+		if (farmThread.joinable())
+			farmThread.join();
+	}
+
+	template <bool RecordAovs>
+	void renderWorker(const Hittable& world, int worker, int node)
+	{
+		// Continuously render the next tile from the queue, preferring the node's own tiles
+		AlignedColors tileBuffer;
 		while (true)
 		{
 			Tile tile;
 
 			{
-				std::lock_guard<std::mutex> lock(queueMutex);
-				if (tileQueue.empty()) return;
-				tile = tileQueue.back();
-				tileQueue.pop_back();
-				std::clog << "\rTiles remaining: " << tileQueue.size() + 1 << " " << std::flush;
+				// Tiles out with the farm come back to the queue if it cannot finish them
+				std::unique_lock<std::mutex> lock(queueMutex);
+				tileReturned.wait(lock, [this]() { return queuedTiles() > 0 || farmTiles == 0; });
+				if (!popTile(node, tile)) return;
 			}
 
-			renderTile(tile, world);
+			renderTile<RecordAovs>(tile, world, worker, tileBuffer);
 		}
 	}
 
-	void renderTile(const Tile& tile, const Hittable& world)
+	template <bool RecordAovs>
+	void renderTile(const Tile& tile, const Hittable& world, int worker, AlignedColors& tileBuffer)
 	{
+		TraceScope trace("Tile", "render", "x", tile.x0, "y", tile.y0);
+		auto tileStart = Timings::Clock::now();
+
+		// Accumulate in the thread's own buffer, then store the finished tile into the image in
+		// one pass. No other thread writes near the buffer, and streamed renders only hold the
+		// tiles in flight.
+		int tileWidth = tile.x1 - tile.x0 + 1;
+		int tileHeight = tile.y1 - tile.y0 + 1;
+		tileBuffer.reserve(static_cast<size_t>(tileWidth) * tileHeight);
+		Color* tilePixels = tileBuffer.data();
+
+		std::unique_ptr<AovTile> aovTile(RecordAovs ? new AovTile(tileWidth * tileHeight) : nullptr);
+		AovRecorder<RecordAovs> recorder(aovTile.get());
+
+		uint64_t secondaryRays = 0;
+		TraversalStats tileStats = Stats::local();
+		shadeTile(tile, world, tilePixels, recorder, secondaryRays);
+
+		if (Stats::enabled)
+		{
+			std::lock_guard<std::mutex> lock(traversalMutex);
+			traversal += Stats::local() - tileStats;
+		}
+
+		storeTile(tile, tilePixels, frame.row(0), frame.stride(), &stream);
+		for (int a = 0; aovTile && a < aovCount; a++)
+		{
+			if (recordedAovs & aovBit(static_cast<Aov>(a)))
+				storeTile(tile, aovTile->layers[a].data(), aovImages[a].data(), imageWidth, aovStreams[a].get());
+		}
+
+		uint64_t tilePixelCount = static_cast<uint64_t>(tileWidth) * tileHeight;
+		metrics->tileDone(worker, tilePixelCount, tilePixelCount * samplesPerPixel, secondaryRays,
+			Timings::Clock::now() - tileStart);
+	}
+
+	template <bool RecordAovs>
+	void shadeTile(
+		const Tile& tile, const Hittable& world, Color* tilePixels,
+		AovRecorder<RecordAovs>& recorder, uint64_t& secondaryRays
+	)
+	{
+		int tileWidth = tile.x1 - tile.x0 + 1;
+
+		// Seeding per tile makes the image independent of the thread count and tile order
+		seedRandom(seed * 0x9E3779B9u + static_cast<uint32_t>(tile.y0 * imageWidth + tile.x0));
+
 		for (int j = tile.y0; j <= tile.y1; j++)
 		{
 			for (int i = tile.x0; i <= tile.x1; i++)
 			{
+				int index = (j - tile.y0) * tileWidth + (i - tile.x0);
+				recorder.beginPixel();
+				uint64_t pixelStart = Stats::enabled ? Stats::local().cost() : 0;
+
 				// Accumulate samples for each pixel
 				Color pixelColor(0.0f, 0.0f, 0.0f);
 				for (int sample = 0; sample < samplesPerPixel; sample++)
 				{
-					Ray ray = getRay(i, j);
-					pixelColor += rayColor(ray, maxDepth, world);
+					RayDifferential diff;
+					Ray ray = getRay(i, j, diff);
+					Color sampleColor = integrator == Integrator::Path
+						? rayColor(ray, maxDepth, world, &diff, recorder, secondaryRays)
+						: normalColor(ray, world, &diff, recorder);
+					recorder.sample(sampleColor);
+					pixelColor += sampleColor;
 				}
 
-				setPixel(i, j, pixelSamplesScale * pixelColor);
+				tilePixels[index] = pixelSamplesScale * pixelColor;
+				recorder.endPixel(index);
+
+				// Remote tiles have no cost image to record into
+				if (Stats::enabled && !costImage.empty())
+					costImage[j * imageWidth + i] = pixelSamplesScale * (Stats::local().cost() - pixelStart);
 			}
 		}
 	}
 
-	void setPixel(int x, int y, Color color)
+	void storeTile(
+		const Tile& tile, const Color* tileData, Color* image, int imageStride,
+		ImageWriter::ImageStream* imageStream
+	)
 	{
-		// Check for out of bounds
-		if (x < 0 || x >= imageWidth || y < 0 || y >= imageHeight)
+		int tileWidth = tile.x1 - tile.x0 + 1;
+		int tileHeight = tile.y1 - tile.y0 + 1;
+
+		if (streamOutput)
 		{
+			TraceScope trace("Stream tile", "write");
+			imageStream->writeTile(tile.x0, tile.y0, tileWidth, tileHeight,
+				reinterpret_cast<const float*>(tileData));
 			return;
 		}
 
-		pixels[y * imageWidth + x] += color;
+		for (int j = 0; j < tileHeight; j++)
+		{
+			std::copy(tileData + j * tileWidth, tileData + (j + 1) * tileWidth,
+				image + static_cast<size_t>(tile.y0 + j) * imageStride + tile.x0);
+		}
+	}
+
+	std::string aovFile(Aov aov) const
+	{
+		// AOVs keep the output's float format, or use OpenEXR next to a PNG
+		std::string ext = ImageWriter::extension(outputFile);
+		if (ext != "hdr" && ext != "pfm" && ext != "exr") ext = "exr";
+		return outputStem() + "." + aovName(aov) + "." + ext;
+	}
+
+	std::string outputStem() const
+	{
+		auto dot = outputFile.find_last_of('.');
+		auto slash = outputFile.find_last_of("/\\");
+		return dot == std::string::npos || (slash != std::string::npos && dot < slash)
+			? outputFile : outputFile.substr(0, dot);
 	}
 
-	void writePNG(const std::string& filename) const
+	bool openStreams()
+	{
+		if (!ImageWriter::ImageStream::supports(outputFile))
+		{
+			std::cerr << "Streaming output needs a .hdr, .pfm or .exr file, not " << outputFile << "\n";
+			return false;
+		}
+		if (!stream.open(outputFile, imageWidth, imageHeight, tileSize))
+		{
+			std::cerr << "Failed to open " << outputFile << " for streaming\n";
+			return false;
+		}
+
+		for (int a = 0; a < aovCount; a++)
+		{
+			if (!(aovs & aovBit(static_cast<Aov>(a)))) continue;
+
+			std::string filename = aovFile(static_cast<Aov>(a));
+			aovStreams[a].reset(new ImageWriter::ImageStream());
+			if (!aovStreams[a]->open(filename, imageWidth, imageHeight, tileSize))
+			{
+				std::cerr << "Failed to open " << filename << " for streaming\n";
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void closeStreams()
+	{
+		reportWrite(outputFile, stream.close());
+		for (int a = 0; a < aovCount; a++)
+		{
+			if (aovStreams[a])
+				reportWrite(aovFile(static_cast<Aov>(a)), aovStreams[a]->close());
+		}
+	}
+
+	void writeImages() const
+	{
+		writeImage(outputFile, frame.pixels());
+		for (int a = 0; a < aovCount; a++)
+		{
+			if (aovs & aovBit(static_cast<Aov>(a)))
+				writeImage(aovFile(static_cast<Aov>(a)), aovImages[a]);
+		}
+	}
+
+	static void reportWrite(const std::string& filename, bool ok)
+	{
+		if (ok)
+			std::cout << "Image saved to " << filename << "\n";
+		else
+			std::cerr << "Failed to save image to " << filename << "\n";
+	}
+
+	void writeImage(const std::string& filename, const std::vector<Color>& image) const
+	{
+		// Float formats store the linear radiance as rendered; PNG is tone mapped to 8 bits
+		std::string ext = ImageWriter::extension(filename);
+		if (ext != "hdr" && ext != "pfm" && ext != "exr")
+		{
+			writePNG(filename, image);
+			return;
+		}
+
+		const float* rgb = reinterpret_cast<const float*>(image.data());
+
+		// The float formats encode each scanline just before writing it
+		TraceScope trace("File write", "write");
+		bool ok;
+		if (ext == "hdr")
+			ok = ImageWriter::writeHDR(filename, imageWidth, imageHeight, rgb);
+		else if (ext == "pfm")
+			ok = ImageWriter::writePFM(filename, imageWidth, imageHeight, rgb);
+		else
+			ok = ImageWriter::writeEXR(filename, imageWidth, imageHeight, rgb);
+
+		reportWrite(filename, ok);
+	}
+
+	void writeHeatmap(const std::string& filename) const
+	{
+		// Scale to the 99th percentile, so a few very expensive pixels do not darken the rest
+		std::vector<float> sorted(costImage);
+		if (sorted.empty()) return;
+		size_t rank = sorted.size() * 99 / 100;
+		std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+		float scale = sorted[rank] > 0.0f ? 1.0f / sorted[rank] : 0.0f;
+
+		std::vector<unsigned char> imageData(costImage.size() * 3);
+		for (size_t i = 0; i < costImage.size(); i++)
+			Stats::heatColor(costImage[i] * scale, &imageData[i * 3]);
+
+		int rc = stbi_write_png(filename.c_str(), imageWidth, imageHeight, 3, imageData.data(), imageWidth * 3);
+		reportWrite(filename, rc != 0);
+		if (rc != 0)
+			std::clog << "Heatmap scale: brightest is " << sorted[rank] << " AABB and primitive tests per sample\n";
+	}
+
+	static void appendBytes(void* context, void* data, int size)
+	{
+		auto bytes = static_cast<unsigned char*>(data);
+		auto out = static_cast<std::vector<unsigned char>*>(context);
+		out->insert(out->end(), bytes, bytes + size);
+	}
+
+	void writePNG(const std::string& filename, const std::vector<Color>& image) const
 	{
 		int strideInBytes = imageWidth * 3 * sizeof(unsigned char);
 		std::vector<unsigned char> imageData(imageWidth * imageHeight * 3);
@@ -246,9 +823,9 @@ private:
 				int index = (j * imageWidth + i);
 
 				// Apply a linear to gamma transformation for gamma 2
-				auto r = linearToGamma(pixels[index].x);
-				auto g = linearToGamma(pixels[index].y);
-				auto b = linearToGamma(pixels[index].z);
+				auto r = linearToGamma(image[index].x);
+				auto g = linearToGamma(image[index].y);
+				auto b = linearToGamma(image[index].z);
 
 				index *= 3;
 				static const Interval intensity(0.0f, 0.999f);
@@ -258,11 +835,18 @@ private:
 			}
 		}
 
-		int rc = stbi_write_png(filename.c_str(), imageWidth, imageHeight, 
-			3, imageData.data(), strideInBytes);
-		if (rc)
-			std::cout << "Image saved to " << filename << "\n";
-		else
-			std::cerr << "Failed to save image to " << filename << "\n";
+		// Encode to memory first, so the trace shows compression and file IO separately
+		std::vector<unsigned char> encoded;
+		{
+			TraceScope trace("PNG encode", "write");
+			stbi_write_png_to_func(appendBytes, &encoded, imageWidth, imageHeight,
+				3, imageData.data(), strideInBytes);
+		}
+
+		TraceScope trace("File write", "write");
+		std::FILE* file = encoded.empty() ? nullptr : std::fopen(filename.c_str(), "wb");
+		bool ok = file && std::fwrite(encoded.data(), encoded.size(), 1, file) == 1;
+		if (file) ok = std::fclose(file) == 0 && ok;
+		reportWrite(filename, ok);
 	}
 };
\ No newline at end of file
@@ -0,0 +1,167 @@
+#pragma once
+
+#include "thread_pool.h"
+#include "timing.h"
+
+#include <algorithm>
+#include <cmath>
+#include <future>
+#include <vector>
+
+// Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010, with the variance guided
+// color weight of SVGF): a 5x5 B-spline kernel applied repeatedly with its taps spread
+// twice as far each pass. Every tap is weighted like a joint bilateral filter by how close
+// its normal and albedo are to the center's, and by its luminance difference relative to
+// the center's noise level, so flat noisy regions smooth strongly while converged edges
+// are kept. Albedo is divided out before filtering and multiplied back afterwards, so
+// texture detail survives. Passes run over tiles on a thread pool.
+class Denoiser
+{
+public:
+	int iterations = 5;
+	float sigmaLuminance = 4.0f;		// In standard deviations of the center pixel
+	float sigmaNormal = 0.3f;
+	float sigmaAlbedo = 0.1f;
+	int tileSize = 64;
+	int threadCount = 0;				// Filter threads, or 0 for one per hardware thread
+
+	// Filters color in place. The guides are AOVs of the same image: albedo, normal and the
+	// variance of each pixel's mean luminance.
+	void denoise(
+		int width, int height, std::vector<Color>& color, const std::vector<Color>& albedo,
+		const std::vector<Color>& normal, const std::vector<Color>& variance
+	) const
+	{
+		ScopedTimer timer("Denoise");
+
+		// Filter irradiance rather than radiance, with its variance scaled to match
+		Layer current(color.size());
+		for (size_t i = 0; i < color.size(); i++)
+		{
+			Color d = demodulation(albedo[i]);
+			float scale = luminance(d);
+			current.color[i] = Color(color[i].x / d.x, color[i].y / d.y, color[i].z / d.z);
+			current.variance[i] = variance[i].x / (scale * scale);
+		}
+
+		ThreadPool pool(threadCount, "Denoise");
+		Layer next(color.size());
+		for (int pass = 0; pass < iterations; pass++)
+		{
+			int step = 1 << pass;
+
+			std::vector<std::future<void>> tiles;
+			for (int y0 = 0; y0 < height; y0 += tileSize)
+			{
+				for (int x0 = 0; x0 < width; x0 += tileSize)
+				{
+					tiles.push_back(pool.submit([&, x0, y0, step]() {
+						TraceScope trace("Denoise tile", "denoise", "x", x0, "y", y0);
+						filterTile(x0, y0, std::min(x0 + tileSize, width), std::min(y0 + tileSize, height),
+							width, height, step, current, albedo, normal, next);
+					}));
+				}
+			}
+			for (auto& tile : tiles)
+				tile.get();
+
+			std::swap(current, next);
+		}
+
+		for (size_t i = 0; i < color.size(); i++)
+			color[i] = current.color[i] * demodulation(albedo[i]);
+	}
+
+private:
+	struct Layer
+	{
+		std::vector<Color> color;
+		std::vector<float> variance;
+
+		Layer(size_t size) : color(size), variance(size) {}
+	};
+
+	static Color demodulation(const Color& albedo)
+	{
+		// The offset keeps black texels from dividing by zero
+		const float offset = 1e-3f;
+		return Color(albedo.x + offset, albedo.y + offset, albedo.z + offset);
+	}
+
+	static float luminance(const Color& c)
+	{
+		return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+	}
+
+	float blurredVariance(const std::vector<float>& variance, int x, int y, int width, int height) const
+	{
+		// A 3x3 blur of the variance steadies the color weight at low sample counts
+		static const float kernel[2] = { 0.25f, 0.125f };
+		float sum = 0.0f, weightSum = 0.0f;
+		for (int j = -1; j <= 1; j++)
+		{
+			for (int i = -1; i <= 1; i++)
+			{
+				int qx = x + i, qy = y + j;
+				if (qx < 0 || qx >= width || qy < 0 || qy >= height) continue;
+
+				float weight = kernel[std::abs(i)] * kernel[std::abs(j)];
+				sum += weight * variance[qy * width + qx];
+				weightSum += weight;
+			}
+		}
+		return sum / weightSum;
+	}
+
+	void filterTile(
+		int x0, int y0, int x1, int y1, int width, int height, int step, const Layer& input,
+		const std::vector<Color>& albedo, const std::vector<Color>& normal, Layer& output
+	) const
+	{
+		static const float kernel[5] = { 1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+
+		float invNormal = 1.0f / (sigmaNormal * sigmaNormal);
+		float invAlbedo = 1.0f / (sigmaAlbedo * sigmaAlbedo);
+
+		for (int y = y0; y < y1; y++)
+		{
+			for (int x = x0; x < x1; x++)
+			{
+				int center = y * width + x;
+				float lum = luminance(input.color[center]);
+				float invLuminance = 1.0f
+					/ (sigmaLuminance * std::sqrt(blurredVariance(input.variance, x, y, width, height)) + 1e-6f);
+
+				Color sum(0.0f, 0.0f, 0.0f);
+				float varianceSum = 0.0f;
+				float weightSum = 0.0f;
+				for (int j = -2; j <= 2; j++)
+				{
+					int qy = y + j * step;
+					if (qy < 0 || qy >= height) continue;
+
+					for (int i = -2; i <= 2; i++)
+					{
+						int qx = x + i * step;
+						if (qx < 0 || qx >= width) continue;
+
+						int q = qy * width + qx;
+						float luminanceDist = std::fabs(luminance(input.color[q]) - lum) * invLuminance;
+						float normalDist = sqrMag(normal[q] - normal[center]);
+						float albedoDist = sqrMag(albedo[q] - albedo[center]);
+
+						float weight = kernel[i + 2] * kernel[j + 2] * std::exp(
+							-luminanceDist - normalDist * invNormal - albedoDist * invAlbedo);
+						sum += weight * input.color[q];
+						varianceSum += weight * weight * input.variance[q];
+						weightSum += weight;
+					}
+				}
+
+				// The center tap always has a weight, so the sum is never zero
+				output.color[center] = sum / weightSum;
+				output.variance[center] = varianceSum / (weightSum * weightSum);
+			}
+		}
+	}
+};
@@ -0,0 +1,388 @@
+#pragma once
+
+#include "camera.h"
+#include "render_options.h"
+#include "render_server.h"
+#include "scene_parser.h"
+#include "socket.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Rendering one image across processes. The coordinator renders with its own threads and
+// also hands tiles to worker processes that connect to its endpoint; each worker loads the
+// same scene text with the same options and returns the finished float pixels of each tile.
+// Tiles are seeded by position, so a tile is bit for bit the same wherever it is rendered
+// and the merged image matches a local render. Tiles out with a worker that disconnects or
+// stops answering go back to the queue.
+//
+// A worker loads the job before it takes tiles, and refuses it rather than render with
+// missing data, such as an image texture it cannot read. The scene path is sent absolute, so
+// workers on a shared file system find the scene's images from any working directory.
+//
+// Messages are a header of two 32-bit words, type and payload size, then the payload, in
+// the byte order of the machines, which must match.
+namespace Distributed
+{
+	enum class Message : uint32_t
+	{
+		Hello,		// Worker: render thread count
+		Job,		// Coordinator: options line, scene path and scene text, one per line
+		Tile,		// Coordinator: tile id and bounds
+		Result,		// Worker: tile id, secondary ray count and RGB floats
+		Done,		// Coordinator: no more tiles
+		Ready,		// Worker: job loaded, send tiles
+		Refused		// Worker: why the job could not be loaded; the worker then disconnects
+	};
+
+	struct TileRequest
+	{
+		uint32_t id;
+		int32_t x0, y0, x1, y1;
+	};
+
+	struct ResultHeader
+	{
+		uint32_t id;
+		uint32_t padding;
+		uint64_t secondaryRays;
+	};
+
+	static const uint32_t maxPayload = 1u << 30;
+
+	inline bool send(Net::Connection& connection, Message type, const void* payload, size_t size)
+	{
+		uint32_t header[2] = { static_cast<uint32_t>(type), static_cast<uint32_t>(size) };
+		return connection.send(header, sizeof(header)) && (size == 0 || connection.send(payload, size));
+	}
+
+	inline bool receive(Net::Connection& connection, Message& type, std::vector<char>& payload)
+	{
+		uint32_t header[2];
+		if (!connection.receive(header, sizeof(header)) || header[1] > maxPayload) return false;
+		type = static_cast<Message>(header[0]);
+		payload.resize(header[1]);
+		return header[1] == 0 || connection.receive(payload.data(), payload.size());
+	}
+}
+
+class TileCoordinator : public TileFarm
+{
+public:
+	// Seconds to wait for a tile before giving up on its worker
+	double tileTimeout = 120.0;
+
+	// Listens before the scene loads, so workers can connect while it does
+	bool open(const std::string& endpoint, std::string& error) { return listener.open(endpoint, error); }
+
+	// What workers render: the command line options, and the scene file's path and text
+	void setJob(const std::vector<std::string>& args, const std::string& scenePath, const std::string& sceneText)
+	{
+		job = RenderServer::join(args) + "\n" + absolutePath(scenePath) + "\n" + sceneText;
+	}
+
+	void run(Camera& camera) override
+	{
+		std::vector<std::thread> handlers;
+		while (!camera.tilesFinished())
+		{
+			auto worker = listener.accept(100);
+			if (worker)
+			{
+				{
+					std::lock_guard<std::mutex> lock(handshakeMutex);
+					handshaking.push_back(worker.get());
+				}
+				handlers.emplace_back(&TileCoordinator::serve, this, std::ref(camera), std::move(worker));
+			}
+		}
+
+		// Workers still loading the job will get no tiles, so the image need not wait for them
+		{
+			std::lock_guard<std::mutex> lock(handshakeMutex);
+			for (Net::Connection* worker : handshaking)
+				worker->shutdown();
+		}
+		for (auto& handler : handlers)
+			handler.join();
+		listener.close();
+	}
+
+private:
+	Net::Listener listener;
+	std::string job;
+	std::mutex handshakeMutex;
+	std::vector<Net::Connection*> handshaking;	// Connected workers that are not yet Ready
+
+	void serve(Camera& camera, std::unique_ptr<Net::Connection> worker)
+	{
+		int32_t threads;
+		bool ready = handshake(*worker, threads);
+		{
+			std::lock_guard<std::mutex> lock(handshakeMutex);
+			handshaking.erase(std::find(handshaking.begin(), handshaking.end(), worker.get()));
+		}
+		if (ready) serveTiles(camera, *worker, threads);
+	}
+
+	// Sends the job and waits until the worker has loaded it, as tiles only go to ready workers
+	bool handshake(Net::Connection& worker, int32_t& threads)
+	{
+		Distributed::Message type;
+		std::vector<char> payload;
+		worker.setTimeout(tileTimeout);
+		if (!Distributed::receive(worker, type, payload) || type != Distributed::Message::Hello
+			|| payload.size() != sizeof(int32_t) || !Distributed::send(worker, Distributed::Message::Job, job.data(), job.size()))
+			return false;
+
+		std::memcpy(&threads, payload.data(), sizeof(threads));
+		if (!Distributed::receive(worker, type, payload)) return false;
+		if (type == Distributed::Message::Refused)
+		{
+			std::clog << "\rWorker refused the job: " << std::string(payload.begin(), payload.end()) << "\n";
+			return false;
+		}
+		return type == Distributed::Message::Ready;
+	}
+
+	void serveTiles(Camera& camera, Net::Connection& worker, int32_t threads)
+	{
+		Distributed::Message type;
+		std::vector<char> payload;
+
+		// Keep every worker thread busy while results travel back
+		size_t inFlightLimit = static_cast<size_t>(std::max(1, std::min(threads, 1024))) * 2;
+		std::clog << "\rWorker joined with " << threads << " threads\n";
+
+		std::map<uint32_t, Tile> inFlight;
+		uint32_t nextId = 0;
+		std::vector<Color> tilePixels;
+		bool ok = true;
+		while (ok)
+		{
+			Tile tile;
+			while (inFlight.size() < inFlightLimit && camera.takeTile(tile))
+			{
+				Distributed::TileRequest request = { nextId, tile.x0, tile.y0, tile.x1, tile.y1 };
+				inFlight[nextId++] = tile;
+				if (!Distributed::send(worker, Distributed::Message::Tile, &request, sizeof(request)))
+				{
+					ok = false;
+					break;
+				}
+			}
+			if (!ok || inFlight.empty()) break;
+
+			ok = Distributed::receive(worker, type, payload) && type == Distributed::Message::Result
+				&& receiveTile(camera, payload, inFlight, tilePixels);
+		}
+
+		if (ok)
+		{
+			Distributed::send(worker, Distributed::Message::Done, nullptr, 0);
+			return;
+		}
+
+		std::clog << "\rWorker lost, reissuing " << inFlight.size() << " tiles\n";
+		for (const auto& entry : inFlight)
+			camera.returnTile(entry.second);
+	}
+
+	static bool receiveTile(
+		Camera& camera, const std::vector<char>& payload, std::map<uint32_t, Tile>& inFlight,
+		std::vector<Color>& tilePixels
+	)
+	{
+		Distributed::ResultHeader header;
+		if (payload.size() < sizeof(header)) return false;
+		std::memcpy(&header, payload.data(), sizeof(header));
+
+		auto found = inFlight.find(header.id);
+		if (found == inFlight.end()) return false;
+		const Tile& tile = found->second;
+		size_t pixelCount = static_cast<size_t>(tile.x1 - tile.x0 + 1) * (tile.y1 - tile.y0 + 1);
+		if (payload.size() != sizeof(header) + pixelCount * sizeof(Color)) return false;
+
+		tilePixels.resize(pixelCount);
+		std::memcpy(tilePixels.data(), payload.data() + sizeof(header), pixelCount * sizeof(Color));
+		camera.finishTile(tile, tilePixels, header.secondaryRays);
+		inFlight.erase(found);
+		return true;
+	}
+};
+
+class TileWorker
+{
+public:
+	int threadCount = 0;					// Render threads, or 0 for one per hardware thread
+	double connectTimeout = 30.0;			// Seconds to keep retrying while the coordinator starts
+
+	// Renders tiles for one coordinator until it is done; returns the process exit status
+	int run(const std::string& endpoint)
+	{
+		std::string error;
+		std::unique_ptr<Net::Connection> coordinator;
+		auto start = Timings::Clock::now();
+		while (!(coordinator = Net::connect(endpoint, error)))
+		{
+			if (Timings::seconds(start, Timings::Clock::now()) > connectTimeout)
+			{
+				std::cerr << "Could not connect to " << endpoint << ": " << error << "\n";
+				return 1;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(500));
+		}
+
+		int32_t threads = threadCount > 0 ? threadCount : static_cast<int32_t>(std::max(1u, std::thread::hardware_concurrency()));
+		Distributed::Message type;
+		std::vector<char> payload;
+		if (!Distributed::send(*coordinator, Distributed::Message::Hello, &threads, sizeof(threads))
+			|| !Distributed::receive(*coordinator, type, payload) || type != Distributed::Message::Job)
+		{
+			std::cerr << "No job from " << endpoint << "\n";
+			return 1;
+		}
+
+		Scene scene;
+		std::ostringstream errors;
+		if (!loadJob(std::string(payload.begin(), payload.end()), scene, errors))
+		{
+			std::string reason = errors.str();
+			std::cerr << reason;
+			reason = reason.substr(0, reason.find('\n'));
+			Distributed::send(*coordinator, Distributed::Message::Refused, reason.data(), reason.size());
+			return 1;
+		}
+		scene.camera.beginRemoteTiles();
+		if (!Distributed::send(*coordinator, Distributed::Message::Ready, nullptr, 0))
+		{
+			std::cerr << "Lost " << endpoint << "\n";
+			return 1;
+		}
+		std::clog << "Rendering tiles for " << endpoint << " on " << threads << " threads\n";
+
+		connection = coordinator.get();
+		std::vector<std::thread> workers;
+		for (int i = 0; i < threads; i++)
+			workers.emplace_back(&TileWorker::renderLoop, this, std::ref(scene));
+
+		receiveLoop();
+		for (auto& worker : workers)
+			worker.join();
+
+		std::clog << "Rendered " << tilesRendered << " tiles\n";
+		return failed ? 1 : 0;
+	}
+
+private:
+	Net::Connection* connection = nullptr;
+	std::mutex mutex;						// Guards the queue and flags
+	std::mutex sendMutex;
+	std::condition_variable tileReady;
+	std::deque<Distributed::TileRequest> tiles;
+	bool closing = false;
+	bool failed = false;
+	int tilesRendered = 0;
+
+	bool loadJob(const std::string& job, Scene& scene, std::ostream& errors)
+	{
+		size_t argsEnd = job.find('\n');
+		size_t pathEnd = argsEnd == std::string::npos ? argsEnd : job.find('\n', argsEnd + 1);
+		if (pathEnd == std::string::npos)
+		{
+			errors << "Malformed job\n";
+			return false;
+		}
+
+		std::vector<std::string> args = RenderServer::split(job.substr(0, argsEnd));
+		std::vector<char*> argv;
+		for (auto& arg : args)
+			argv.push_back(&arg[0]);
+
+		RenderOptions options;
+		if (!parseOptions(static_cast<int>(argv.size()), argv.data(), options, errors)) return false;
+
+		std::string path = job.substr(argsEnd + 1, pathEnd - argsEnd - 1);
+		if (!SceneParser::load(path, job.substr(pathEnd + 1), scene, options.bvh, errors)) return false;
+
+		// Tiles rendered with a placeholder for a missing image would differ from the
+		// coordinator's own
+		if (!TextureLoader::wait())
+		{
+			errors << "Could not load the image textures of " << path << "\n";
+			return false;
+		}
+
+		// Same settings as the coordinator's camera, apart from this machine's thread count
+		options.apply(scene.camera);
+		scene.camera.threadCount = threadCount;
+		return true;
+	}
+
+	void receiveLoop()
+	{
+		Distributed::Message type;
+		std::vector<char> payload;
+		while (true)
+		{
+			bool ok = Distributed::receive(*connection, type, payload);
+			Distributed::TileRequest request;
+			bool tile = ok && type == Distributed::Message::Tile && payload.size() == sizeof(request);
+			if (tile)
+			{
+				std::memcpy(&request, payload.data(), sizeof(request));
+				tile = request.x0 >= 0 && request.y0 >= 0 && request.x1 >= request.x0 && request.y1 >= request.y0
+					&& request.x1 - request.x0 < 4096 && request.y1 - request.y0 < 4096;
+			}
+
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!tile)
+			{
+				failed = !ok || type != Distributed::Message::Done;
+				closing = true;
+				tileReady.notify_all();
+				return;
+			}
+			tiles.push_back(request);
+			tileReady.notify_one();
+		}
+	}
+
+	void renderLoop(Scene& scene)
+	{
+		std::vector<Color> tilePixels;
+		std::vector<char> result;
+		while (true)
+		{
+			Distributed::TileRequest request;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				tileReady.wait(lock, [this]() { return closing || !tiles.empty(); });
+				if (tiles.empty()) return;
+				request = tiles.front();
+				tiles.pop_front();
+			}
+
+			Tile tile = { request.x0, request.y0, request.x1, request.y1 };
+			Distributed::ResultHeader header = { request.id, 0, scene.camera.renderRemoteTile(tile, scene.world, tilePixels) };
+			result.resize(sizeof(header) + tilePixels.size() * sizeof(Color));
+			std::memcpy(result.data(), &header, sizeof(header));
+			std::memcpy(result.data() + sizeof(header), tilePixels.data(), tilePixels.size() * sizeof(Color));
+
+			std::lock_guard<std::mutex> lock(sendMutex);
+			Distributed::send(*connection, Distributed::Message::Result, result.data(), result.size());
+			tilesRendered++;
+		}
+	}
+};
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+// Colors starting on a cache line, left uninitialized. Memory is kept when a later reserve
+// fits in it, so a buffer reused for each tile is allocated once per thread.
+class AlignedColors
+{
+public:
+	static const size_t cacheLine = 64;
+
+	AlignedColors() {}
+	~AlignedColors() { release(); }
+
+	AlignedColors(const AlignedColors&) = delete;
+	AlignedColors& operator=(const AlignedColors&) = delete;
+
+	// Contents are undefined afterwards
+	void reserve(size_t count)
+	{
+		if (count <= capacity) return;
+		release();
+
+		size_t bytes = (count * sizeof(Color) + cacheLine - 1) / cacheLine * cacheLine;
+#ifdef _WIN32
+		void* memory = _aligned_malloc(bytes, cacheLine);
+#else
+		void* memory = nullptr;
+		if (posix_memalign(&memory, cacheLine, bytes) != 0) memory = nullptr;
+#endif
+		if (!memory) throw std::bad_alloc();
+		colors = static_cast<Color*>(memory);
+		capacity = count;
+	}
+
+	void release()
+	{
+#ifdef _WIN32
+		_aligned_free(colors);
+#else
+		std::free(colors);
+#endif
+		colors = nullptr;
+		capacity = 0;
+	}
+
+	Color* data() { return colors; }
+	const Color* data() const { return colors; }
+
+private:
+	Color* colors = nullptr;
+	size_t capacity = 0;
+};
+
+// Float RGB image that render threads store finished tiles into. Rows are padded to whole
+// cache lines, so with tiles a multiple of 16 pixels wide no cache line holds pixels of two
+// tiles, and threads storing neighbouring tiles never write the same line.
+//
+// Allocating does not clear the memory, so each page is first touched, and on NUMA machines
+// placed, by the thread that stores the first tile into it rather than by the thread that
+// allocated the image. Every pixel must be stored before the image is read.
+class FrameBuffer
+{
+public:
+	void allocate(int width, int height)
+	{
+		if (width == w && height == h) return;
+
+		// Colors are 12 bytes, so rows of a multiple of 16 fill whole 64 byte lines
+		const int rowAlignment = 16;
+		static_assert(rowAlignment * sizeof(Color) % AlignedColors::cacheLine == 0, "rows must end on a line");
+		w = width;
+		h = height;
+		rowStride = (width + rowAlignment - 1) / rowAlignment * rowAlignment;
+		colors.reserve(static_cast<size_t>(rowStride) * height);
+	}
+
+	bool empty() const { return w == 0 || h == 0; }
+	int width() const { return w; }
+	int height() const { return h; }
+	int stride() const { return rowStride; }		// Colors from one row to the next
+
+	Color* row(int y) { return colors.data() + static_cast<size_t>(y) * rowStride; }
+	const Color* row(int y) const { return colors.data() + static_cast<size_t>(y) * rowStride; }
+
+	// Copy of the pixels without the row padding
+	std::vector<Color> pixels() const
+	{
+		std::vector<Color> image(static_cast<size_t>(w) * h);
+		for (int y = 0; y < h; y++)
+			std::copy(row(y), row(y) + w, image.begin() + static_cast<size_t>(y) * w);
+		return image;
+	}
+
+	void assign(const std::vector<Color>& image)
+	{
+		for (int y = 0; y < h; y++)
+			std::copy(image.begin() + static_cast<size_t>(y) * w, image.begin() + static_cast<size_t>(y + 1) * w, row(y));
+	}
+
+private:
+	AlignedColors colors;
+	int w = 0;
+	int h = 0;
+	int rowStride = 0;
+};
@@ -1,32 +1,245 @@
 #pragma once
 
 #include "aabb.h"
+#include "stats.h"
+#include "track.h"
 
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+class Hittable;
 class Material;
 
+// Primitives and transforms of one scene, found by id from a RayHit. Objects register with
+// the registry current on their thread when they are constructed: the scene's while it
+// loads, so that ids count from 0 in each scene and the entries go with the scene, or a
+// process-wide one for objects made outside any scene. Registration happens at scene setup;
+// lookups during rendering do not lock.
+class HittableRegistry
+{
+public:
+	uint32_t addPrimitive(const Hittable* object, uint32_t count)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		uint32_t id = static_cast<uint32_t>(primitives.size());
+		primitives.insert(primitives.end(), count, object);
+		return id;
+	}
+
+	uint32_t addInstance(const Hittable* object)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		instances.push_back(object);
+		return static_cast<uint32_t>(instances.size() - 1);
+	}
+
+	const Hittable* primitive(uint32_t id) const { return primitives[id]; }
+	const Hittable* instance(uint32_t id) const { return instances[id]; }
+
+	// Makes a registry current on the calling thread while the scope lasts
+	class Scope
+	{
+	public:
+		explicit Scope(const std::shared_ptr<HittableRegistry>& registry) : previous(currentPointer())
+		{
+			currentPointer() = registry;
+		}
+		~Scope() { currentPointer() = previous; }
+
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+
+	private:
+		std::shared_ptr<HittableRegistry> previous;
+	};
+
+	static std::shared_ptr<HittableRegistry> current()
+	{
+		const std::shared_ptr<HittableRegistry>& registry = currentPointer();
+		return registry ? registry : global();
+	}
+
+	// Registry of objects made outside any scene
+	static const std::shared_ptr<HittableRegistry>& global()
+	{
+		static std::shared_ptr<HittableRegistry> registry = std::make_shared<HittableRegistry>();
+		return registry;
+	}
+
+private:
+	std::vector<const Hittable*> primitives;
+	std::vector<const Hittable*> instances;
+	std::mutex mutex;
+
+	static std::shared_ptr<HittableRegistry>& currentPointer()
+	{
+		static thread_local std::shared_ptr<HittableRegistry> registry;
+		return registry;
+	}
+};
+
+// Compact result of a traversal, written by the intersection kernels. It holds only what
+// is needed to reconstruct the full surface interaction once the closest hit is known.
+struct RayHit
+{
+	float t;
+	uint32_t primId;
+	uint32_t instId;		// Outermost transform the hit was found through, if any
+	uint16_t b0, b1;		// Surface parameters of the hit in unorm16
+
+	void setBarycentrics(float a, float b)
+	{
+		b0 = static_cast<uint16_t>(a * 65535.0f + 0.5f);
+		b1 = static_cast<uint16_t>(b * 65535.0f + 0.5f);
+	}
+
+	float barycentric0() const { return b0 * (1.0f / 65535.0f); }
+	float barycentric1() const { return b1 * (1.0f / 65535.0f); }
+};
+
+static_assert(sizeof(RayHit) == 16, "RayHit should stay 16 bytes");
+
+// Full surface interaction, reconstructed from a RayHit for shading
 struct HitRecord 
 {
 	Point3 p;
 	Vec3 normal;
-	std::shared_ptr<Material> mat;
+	const Material* mat;
 	float t;
 	float u;
 	float v;
 	bool frontFace;
 
+	Vec3 dpdu, dpdv;					// Surface tangents along the texture coordinates
+	float filterU = 0.0f;				// Texture space footprint of the hit, if known
+	float filterV = 0.0f;
+
 	void setFaceNormal(const Ray& ray, const Vec3& outwardNormal) 
 	{
 		frontFace = dot(ray.dir, outwardNormal) < 0;
 		normal = frontFace ? outwardNormal : -outwardNormal;
 	}
+
+	void setFilterWidth(const RayDifferential& diff)
+	{
+		// Intersect the offset rays with the tangent plane at the hit point
+		float dx = dot(normal, diff.rxDir);
+		float dy = dot(normal, diff.ryDir);
+		if (std::fabs(dx) < 1e-8f || std::fabs(dy) < 1e-8f) return;
+
+		Vec3 dpdx = diff.rxOrigin + (dot(normal, p - diff.rxOrigin) / dx) * diff.rxDir - p;
+		Vec3 dpdy = diff.ryOrigin + (dot(normal, p - diff.ryOrigin) / dy) * diff.ryDir - p;
+
+		// Express the screen space offsets in texture coordinates by least squares
+		float uu = dot(dpdu, dpdu), uv = dot(dpdu, dpdv), vv = dot(dpdv, dpdv);
+		float det = uu * vv - uv * uv;
+		if (std::fabs(det) < 1e-12f) return;
+
+		float invDet = 1.0f / det;
+		float dudx = (vv * dot(dpdu, dpdx) - uv * dot(dpdv, dpdx)) * invDet;
+		float dvdx = (uu * dot(dpdv, dpdx) - uv * dot(dpdu, dpdx)) * invDet;
+		float dudy = (vv * dot(dpdu, dpdy) - uv * dot(dpdv, dpdy)) * invDet;
+		float dvdy = (uu * dot(dpdv, dpdy) - uv * dot(dpdu, dpdy)) * invDet;
+
+		filterU = std::fmax(std::fabs(dudx), std::fabs(dudy));
+		filterV = std::fmax(std::fabs(dvdx), std::fabs(dvdy));
+	}
 };
 
 class Hittable 
 {
 public:
+	static const uint32_t noInstance = 0xffffffff;
+
+	// Objects copied so far into one replica, so that objects shared in the scene stay shared
+	typedef std::unordered_map<const Hittable*, std::shared_ptr<Hittable>> Replicas;
+
 	virtual ~Hittable() = default;
-	virtual bool hit(const Ray& ray, Interval rayT, HitRecord& record) const = 0;
+
+	// Find the closest hit in rayT, writing only the compact hit on success
+	virtual bool hit(const Ray& ray, Interval rayT, RayHit& rayHit) const = 0;
 	virtual AABB boundingBox() const = 0;
+
+	// Bounds at the start and end of the shutter. Interpolating them by a ray's time bounds
+	// the object at that time, for objects that move linearly or not at all.
+	virtual void motionBounds(AABB& start, AABB& end) const
+	{
+		start = end = boundingBox();
+	}
+
+	virtual void surface(const Ray& ray, const RayHit& rayHit, HitRecord& record) const
+	{
+		// Aggregates defer to the primitive that reported the hit
+		registry().primitive(rayHit.primId)->surface(ray, rayHit, record);
+	}
+
+	// Registry the ids of hits below this object refer to. Aggregates keep the one that was
+	// current when they were built.
+	virtual const HittableRegistry& registry() const { return *HittableRegistry::global(); }
+
+	// Whether a transform is somewhere below this object, in which case the primitive
+	// table alone cannot reconstruct the hit in world space
+	virtual bool hasInstances() const { return false; }
+
+	// Poses animated objects at a time in seconds, returning whether any bounding box below
+	// this object changed. Aggregates refit their bounds rather than rebuilding.
+	virtual bool update(float time) { return false; }
+
+	// Deep copy of this object and those below it, allocated by the calling thread. Copies
+	// keep the ids of the originals, so hits found in a copy are shaded by the originals,
+	// and share their materials.
+	virtual std::shared_ptr<Hittable> replicate(Replicas& replicas) const = 0;
+
+	// Reconstructs the surface interaction of a hit returned from this object, the scene root
+	void surfaceInteraction(const Ray& ray, const RayHit& rayHit, HitRecord& record) const
+	{
+		Stats::Uncounted uncounted;
+		const HittableRegistry& objects = registry();
+		if (rayHit.instId != noInstance)
+			objects.instance(rayHit.instId)->surface(ray, rayHit, record);
+		else
+			objects.primitive(rayHit.primId)->surface(ray, rayHit, record);
+		record.t = rayHit.t;
+	}
+
+protected:
+	// Primitives and transforms register themselves to be found by id from a RayHit
+	static uint32_t registerPrimitive(const Hittable* object, uint32_t count = 1)
+	{
+		return HittableRegistry::current()->addPrimitive(object, count);
+	}
+
+	static uint32_t registerInstance(const Hittable* object)
+	{
+		return HittableRegistry::current()->addInstance(object);
+	}
+
+	static std::shared_ptr<Hittable> replicateChild(const std::shared_ptr<Hittable>& child, Replicas& replicas)
+	{
+		auto found = replicas.find(child.get());
+		if (found != replicas.end()) return found->second;
+		return replicas[child.get()] = child->replicate(replicas);
+	}
+
+	static bool surfaceFromChild(
+		const Hittable& child, const Ray& ray, const RayHit& rayHit, HitRecord& record
+	)
+	{
+		// Re-intersect a child at the known distance to see whether it produced the hit,
+		// so that transforms below it get to map the record back out of their space
+		RayHit childHit;
+		Interval rayT(rayHit.t * (1.0f - 1e-4f), rayHit.t * (1.0f + 1e-4f));
+		if (!child.boundingBox().hit(ray, rayT) || !child.hit(ray, rayT, childHit))
+			return false;
+		if (childHit.primId != rayHit.primId)
+			return false;
+
+		child.surface(ray, childHit, record);
+		return true;
+	}
 };
 
 class Translate : public Hittable
@@ -34,27 +247,74 @@ class Translate : public Hittable
 private:
 	std::shared_ptr<Hittable> object;
 	Vec3 offset;
+	Track<Vec3> path;					// Offsets over time, if animated
 	AABB bbox;
+	uint32_t instId;
 
 public:
 	Translate(std::shared_ptr<Hittable> object, const Vec3& offset)
 		: object(object), offset(offset)
 	{
 		bbox = object->boundingBox() + offset;
+		instId = registerInstance(this);
+	}
+
+	Translate(std::shared_ptr<Hittable> object, const Track<Vec3>& path)
+		: Translate(object, path.at(path.startTime()))
+	{
+		this->path = path;
 	}
 
-	bool hit(const Ray& ray, Interval rayT, HitRecord& record) const override
+	bool hit(const Ray& ray, Interval rayT, RayHit& rayHit) const override
 	{
 		// Transform the ray from world space to object space
 		Ray offsetRay(ray.origin - offset, ray.dir, ray.time);
 
 		// Determine if and where an intersection exists in object space
-		if (!object->hit(offsetRay, rayT, record))
+		if (!object->hit(offsetRay, rayT, rayHit))
 			return false;
 
+		// Outer transforms overwrite inner ones, so the id names the outermost
+		rayHit.instId = instId;
+		return true;
+	}
+
+	void surface(const Ray& ray, const RayHit& rayHit, HitRecord& record) const override
+	{
+		Ray offsetRay(ray.origin - offset, ray.dir, ray.time);
+		object->surface(offsetRay, rayHit, record);
+
 		// Transform the intersection point back to world space
 		record.p += offset;
-		return true;
+	}
+
+	bool hasInstances() const override { return true; }
+
+	std::shared_ptr<Hittable> replicate(Replicas& replicas) const override
+	{
+		auto copy = std::make_shared<Translate>(*this);
+		copy->object = replicateChild(object, replicas);
+		return copy;
+	}
+
+	void motionBounds(AABB& start, AABB& end) const override
+	{
+		object->motionBounds(start, end);
+		start = start + offset;
+		end = end + offset;
+	}
+
+	bool update(float time) override
+	{
+		bool changed = object->update(time);
+		if (!path.empty())
+		{
+			Vec3 next = path.at(time);
+			changed = changed || next.x != offset.x || next.y != offset.y || next.z != offset.z;
+			offset = next;
+		}
+		if (changed) bbox = object->boundingBox() + offset;
+		return changed;
 	}
 
 	AABB boundingBox() const override { return bbox; }
@@ -64,28 +324,34 @@ class RotateY : public Hittable
 {
 private:
 	std::shared_ptr<Hittable> object;
+	float angle;
 	float sinTheta;
 	float cosTheta;
+	Track<float> angles;				// Angles over time, if animated
 	AABB bbox;
+	uint32_t instId;
 
-public:
-	RotateY(std::shared_ptr<Hittable> object, float angle) : object(object)
+	void setAngle(float degrees)
 	{
+		angle = degrees;
 		float radians = degreesToRadians(angle);
 		sinTheta = std::sin(radians);
 		cosTheta = std::cos(radians);
-		bbox = object->boundingBox();
+		bbox = rotatedBox(object->boundingBox());
+	}
 
+	AABB rotatedBox(const AABB& objectBox) const
+	{
 		// Calculate the bounding box of the rotated object
-		Point3 min(infinity, bbox.y.min, infinity);
-		Point3 max(infinity, bbox.y.max, infinity);
+		Point3 min(infinity, objectBox.y.min, infinity);
+		Point3 max(-infinity, objectBox.y.max, -infinity);
 
 		for (int i = 0; i < 2; i++)
 		{
 			for (int k = 0; k < 2; k++)
 			{
-				float cornerX = i * bbox.x.max + (1 - i) * bbox.x.min;
-				float cornerZ = k * bbox.z.max + (1 - k) * bbox.z.min;
+				float cornerX = i * objectBox.x.max + (1 - i) * objectBox.x.min;
+				float cornerZ = k * objectBox.z.max + (1 - k) * objectBox.z.min;
 
 				float x = cosTheta * cornerX + sinTheta * cornerZ;
 				float z = -sinTheta * cornerX + cosTheta * cornerZ;
@@ -97,10 +363,23 @@ public:
 			}
 		}
 
-		bbox = AABB(min, max);
+		return AABB(min, max);
+	}
+
+public:
+	RotateY(std::shared_ptr<Hittable> object, float angle) : object(object)
+	{
+		instId = registerInstance(this);
+		setAngle(angle);
+	}
+
+	RotateY(std::shared_ptr<Hittable> object, const Track<float>& angles)
+		: RotateY(object, angles.at(angles.startTime()))
+	{
+		this->angles = angles;
 	}
 
-	bool hit(const Ray& r, Interval rayT, HitRecord& record) const override
+	bool hit(const Ray& r, Interval rayT, RayHit& rayHit) const override
 	{
 		// Transform the ray from world space to object space
 		Point3 origin = rotateToObject(r.origin);
@@ -108,12 +387,48 @@ public:
 		Ray rotatedRay(origin, dir, r.time);
 
 		// Determine if and where an intersection exists in object space
-		if (!object->hit(rotatedRay, rayT, record))
+		if (!object->hit(rotatedRay, rayT, rayHit))
 			return false;
 
+		rayHit.instId = instId;
+		return true;
+	}
+
+	void surface(const Ray& r, const RayHit& rayHit, HitRecord& record) const override
+	{
+		Ray rotatedRay(rotateToObject(r.origin), rotateToObject(r.dir), r.time);
+		object->surface(rotatedRay, rayHit, record);
+
 		// Transform the intersection point back to world space
 		record.p = rotateToWorld(record.p);
 		record.normal = rotateToWorld(record.normal);
+		record.dpdu = rotateToWorld(record.dpdu);
+		record.dpdv = rotateToWorld(record.dpdv);
+	}
+
+	bool hasInstances() const override { return true; }
+
+	std::shared_ptr<Hittable> replicate(Replicas& replicas) const override
+	{
+		auto copy = std::make_shared<RotateY>(*this);
+		copy->object = replicateChild(object, replicas);
+		return copy;
+	}
+
+	void motionBounds(AABB& start, AABB& end) const override
+	{
+		// Rotation is linear, so corners moving linearly in object space still do in world space
+		object->motionBounds(start, end);
+		start = rotatedBox(start);
+		end = rotatedBox(end);
+	}
+
+	bool update(float time) override
+	{
+		bool changed = object->update(time);
+		float next = angles.empty() ? angle : angles.at(time);
+		if (!changed && next == angle) return false;
+		setAngle(next);
 		return true;
 	}
 
@@ -12,30 +12,79 @@ public:
 	HittableList() {}
 	HittableList(std::shared_ptr<Hittable> object) { add(object); }
 
-	void clear() { objects.clear(); }
+	void clear() { objects.clear(); containsInstances = false; }
 	void add(std::shared_ptr<Hittable> object) {
 		objects.push_back(object);
 		bbox = AABB(bbox, object->boundingBox());
+		containsInstances = containsInstances || object->hasInstances();
 	}
 
-	bool hit(const Ray& ray, Interval rayT, HitRecord& record) const override {
-		HitRecord tempRecord;
+	bool hit(const Ray& ray, Interval rayT, RayHit& rayHit) const override {
 		bool hitAnything = false;
 		float closest = rayT.max;
 
+		// Objects only write the hit when it is closer, so no candidate copy is needed
 		for (const auto& object : objects) {
-			if (object->hit(ray, Interval(rayT.min, closest), tempRecord)) {
+			if (object->hit(ray, Interval(rayT.min, closest), rayHit)) {
 				hitAnything = true;
-				closest = tempRecord.t;
-				record = tempRecord;
+				closest = rayHit.t;
 			}
 		}
 
 		return hitAnything;
 	}
 
+	void surface(const Ray& ray, const RayHit& rayHit, HitRecord& record) const override {
+		if (!containsInstances) {
+			Hittable::surface(ray, rayHit, record);
+			return;
+		}
+
+		for (const auto& object : objects) {
+			if (surfaceFromChild(*object, ray, rayHit, record)) return;
+		}
+	}
+
+	bool hasInstances() const override { return containsInstances; }
+
+	const HittableRegistry& registry() const override { return *objectRegistry; }
+
+	std::shared_ptr<Hittable> replicate(Replicas& replicas) const override {
+		auto copy = std::make_shared<HittableList>(*this);
+		for (auto& object : copy->objects) {
+			object = replicateChild(object, replicas);
+		}
+		return copy;
+	}
+
+	void motionBounds(AABB& start, AABB& end) const override {
+		start = end = AABB::Empty;
+		for (const auto& object : objects) {
+			AABB objectStart, objectEnd;
+			object->motionBounds(objectStart, objectEnd);
+			start = AABB(start, objectStart);
+			end = AABB(end, objectEnd);
+		}
+	}
+
+	bool update(float time) override {
+		bool changed = false;
+		for (const auto& object : objects) {
+			changed = object->update(time) || changed;
+		}
+		if (changed) {
+			bbox = AABB::Empty;
+			for (const auto& object : objects) {
+				bbox = AABB(bbox, object->boundingBox());
+			}
+		}
+		return changed;
+	}
+
 	AABB boundingBox() const override { return bbox; }
 
 private:
 	AABB bbox;
+	bool containsInstances = false;
+	std::shared_ptr<HittableRegistry> objectRegistry = HittableRegistry::current();
 };
\ No newline at end of file
@@ -0,0 +1,371 @@
+#pragma once
+
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Writers for linear floating point images, without external libraries. All of them take
+// interleaved RGB floats in scanline order, top row first. ImageStream writes the same
+// formats a tile at a time, for images too large to hold in memory.
+
+namespace ImageWriter
+{
+	inline std::string extension(const std::string& filename)
+	{
+		auto dot = filename.find_last_of('.');
+		if (dot == std::string::npos) return "";
+
+		std::string ext = filename.substr(dot + 1);
+		for (auto& c : ext)
+			c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+		return ext;
+	}
+
+	inline void toRGBE(const float* pixel, unsigned char* rgbe)
+	{
+		float r = std::fmax(pixel[0], 0.0f);
+		float g = std::fmax(pixel[1], 0.0f);
+		float b = std::fmax(pixel[2], 0.0f);
+		float maxComponent = std::fmax(r, std::fmax(g, b));
+
+		// Shared exponent encoding: mantissas scaled so the largest lands in [128, 256)
+		if (maxComponent < 1e-32f)
+		{
+			rgbe[0] = rgbe[1] = rgbe[2] = rgbe[3] = 0;
+			return;
+		}
+
+		int exponent;
+		float scale = std::frexp(maxComponent, &exponent) * 256.0f / maxComponent;
+		rgbe[0] = static_cast<unsigned char>(r * scale);
+		rgbe[1] = static_cast<unsigned char>(g * scale);
+		rgbe[2] = static_cast<unsigned char>(b * scale);
+		rgbe[3] = static_cast<unsigned char>(exponent + 128);
+	}
+
+	inline std::string headerHDR(int width, int height)
+	{
+		return "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y " + std::to_string(height)
+			+ " +X " + std::to_string(width) + "\n";
+	}
+
+	inline std::string headerPFM(int width, int height)
+	{
+		return "PF\n" + std::to_string(width) + " " + std::to_string(height) + "\n-1.0\n";
+	}
+
+	// Radiance RGBE (.hdr), written as flat scanlines
+	inline bool writeHDR(const std::string& filename, int width, int height, const float* rgb)
+	{
+		std::FILE* file = std::fopen(filename.c_str(), "wb");
+		if (!file) return false;
+
+		std::string header = headerHDR(width, height);
+		std::fputs(header.c_str(), file);
+
+		std::vector<unsigned char> scanline(width * 4);
+		bool ok = true;
+		for (int j = 0; j < height && ok; j++)
+		{
+			for (int i = 0; i < width; i++)
+				toRGBE(rgb + (j * width + i) * 3, &scanline[i * 4]);
+			ok = std::fwrite(scanline.data(), scanline.size(), 1, file) == 1;
+		}
+
+		return std::fclose(file) == 0 && ok;
+	}
+
+	// Portable float map (.pfm): little-endian floats, bottom row first
+	inline bool writePFM(const std::string& filename, int width, int height, const float* rgb)
+	{
+		std::FILE* file = std::fopen(filename.c_str(), "wb");
+		if (!file) return false;
+
+		std::string header = headerPFM(width, height);
+		std::fputs(header.c_str(), file);
+
+		bool ok = true;
+		for (int j = height - 1; j >= 0 && ok; j--)
+			ok = std::fwrite(rgb + j * width * 3, sizeof(float) * 3, width, file) == static_cast<size_t>(width);
+
+		return std::fclose(file) == 0 && ok;
+	}
+
+	// OpenEXR helpers. The format is little-endian throughout.
+	namespace Exr
+	{
+		inline void put(std::vector<unsigned char>& out, const void* data, size_t size)
+		{
+			const unsigned char* bytes = static_cast<const unsigned char*>(data);
+			out.insert(out.end(), bytes, bytes + size);
+		}
+
+		inline void putString(std::vector<unsigned char>& out, const char* s)
+		{
+			put(out, s, std::strlen(s) + 1);
+		}
+
+		template <typename T>
+		inline void putValue(std::vector<unsigned char>& out, T value)
+		{
+			put(out, &value, sizeof(T));
+		}
+
+		inline void attribute(
+			std::vector<unsigned char>& out, const char* name, const char* type,
+			const std::vector<unsigned char>& value
+		)
+		{
+			putString(out, name);
+			putString(out, type);
+			putValue<int32_t>(out, static_cast<int32_t>(value.size()));
+			out.insert(out.end(), value.begin(), value.end());
+		}
+
+		// Header shared by scanline and tiled files, with 32-bit float B, G, R channels.
+		// Tiled files pass their tile size; scanline files pass 0.
+		inline std::vector<unsigned char> header(int width, int height, int tileSize)
+		{
+			std::vector<unsigned char> out;
+			putValue<int32_t>(out, 20000630);						// Magic number
+			putValue<int32_t>(out, tileSize > 0 ? 2 | 0x200 : 2);	// Version 2, tiled flag
+
+			std::vector<unsigned char> channels;
+			const char* names[] = { "B", "G", "R" };				// Channels sorted by name
+			for (auto name : names)
+			{
+				putString(channels, name);
+				putValue<int32_t>(channels, 2);						// FLOAT
+				putValue<int32_t>(channels, 0);						// pLinear and reserved
+				putValue<int32_t>(channels, 1);						// xSampling
+				putValue<int32_t>(channels, 1);						// ySampling
+			}
+			channels.push_back(0);
+			attribute(out, "channels", "chlist", channels);
+
+			attribute(out, "compression", "compression", std::vector<unsigned char>(1, 0));
+
+			std::vector<unsigned char> window;
+			putValue<int32_t>(window, 0);
+			putValue<int32_t>(window, 0);
+			putValue<int32_t>(window, width - 1);
+			putValue<int32_t>(window, height - 1);
+			attribute(out, "dataWindow", "box2i", window);
+			attribute(out, "displayWindow", "box2i", window);
+
+			// Tiles are stored in the order they finish (RANDOM_Y), scanlines top down (INCREASING_Y)
+			attribute(out, "lineOrder", "lineOrder", std::vector<unsigned char>(1, tileSize > 0 ? 2 : 0));
+
+			std::vector<unsigned char> aspect;
+			putValue<float>(aspect, 1.0f);
+			attribute(out, "pixelAspectRatio", "float", aspect);
+
+			std::vector<unsigned char> center;
+			putValue<float>(center, 0.0f);
+			putValue<float>(center, 0.0f);
+			attribute(out, "screenWindowCenter", "v2f", center);
+			attribute(out, "screenWindowWidth", "float", aspect);
+
+			if (tileSize > 0)
+			{
+				std::vector<unsigned char> tiles;
+				putValue<uint32_t>(tiles, static_cast<uint32_t>(tileSize));
+				putValue<uint32_t>(tiles, static_cast<uint32_t>(tileSize));
+				tiles.push_back(0);									// ONE_LEVEL, ROUND_DOWN
+				attribute(out, "tiles", "tiledesc", tiles);
+			}
+
+			out.push_back(0);										// End of header
+			return out;
+		}
+
+		// Pixel data of one row of a block: all B values, then G, then R
+		inline void putRow(std::vector<unsigned char>& out, const float* rgb, int count)
+		{
+			for (int c = 2; c >= 0; c--)
+			{
+				for (int i = 0; i < count; i++)
+					putValue<float>(out, rgb[i * 3 + c]);
+			}
+		}
+	}
+
+	// Uncompressed scanline OpenEXR (.exr), one scanline per block
+	inline bool writeEXR(const std::string& filename, int width, int height, const float* rgb)
+	{
+		std::FILE* file = std::fopen(filename.c_str(), "wb");
+		if (!file) return false;
+
+		std::vector<unsigned char> header = Exr::header(width, height, 0);
+		uint64_t blockSize = 8 + static_cast<uint64_t>(width) * 3 * sizeof(float);
+
+		std::vector<unsigned char> offsets;
+		uint64_t offset = header.size() + static_cast<uint64_t>(height) * sizeof(uint64_t);
+		for (int j = 0; j < height; j++, offset += blockSize)
+			Exr::putValue<uint64_t>(offsets, offset);
+
+		bool ok = std::fwrite(header.data(), header.size(), 1, file) == 1
+			&& std::fwrite(offsets.data(), offsets.size(), 1, file) == 1;
+
+		std::vector<unsigned char> block;
+		for (int j = 0; j < height && ok; j++)
+		{
+			block.clear();
+			Exr::putValue<int32_t>(block, j);
+			Exr::putValue<int32_t>(block, static_cast<int32_t>(blockSize - 8));
+			Exr::putRow(block, rgb + j * width * 3, width);
+			ok = std::fwrite(block.data(), block.size(), 1, file) == 1;
+		}
+
+		return std::fclose(file) == 0 && ok;
+	}
+
+	// Writes an image tile by tile as the tiles finish, so only tiles in flight are held in
+	// memory. OpenEXR output is tiled, with its offset table filled in when the stream is
+	// closed; PFM and HDR store fixed size pixels, so tiles are written in place. Tiles must
+	// lie on the tile grid given to open(). Safe to call from several threads.
+	class ImageStream
+	{
+	public:
+		~ImageStream() { close(); }
+
+		static bool supports(const std::string& filename)
+		{
+			std::string ext = extension(filename);
+			return ext == "exr" || ext == "pfm" || ext == "hdr";
+		}
+
+		bool open(const std::string& filename, int width, int height, int tileSize)
+		{
+			std::string ext = extension(filename);
+			format = ext == "exr" ? Format::Exr : ext == "pfm" ? Format::Pfm : Format::Hdr;
+			this->width = width;
+			this->height = height;
+			this->tileSize = tileSize;
+			tilesX = (width + tileSize - 1) / tileSize;
+			tilesY = (height + tileSize - 1) / tileSize;
+			failed = false;
+
+			file = std::fopen(filename.c_str(), "wb");
+			if (!file) return false;
+
+			if (format == Format::Exr)
+			{
+				// Reserve the offset table; tile data is appended after it
+				std::vector<unsigned char> header = Exr::header(width, height, tileSize);
+				offsetTable = header.size();
+				tileOffsets.assign(static_cast<size_t>(tilesX) * tilesY, 0);
+				std::vector<unsigned char> table(tileOffsets.size() * sizeof(uint64_t), 0);
+				failed = std::fwrite(header.data(), header.size(), 1, file) != 1
+					|| std::fwrite(table.data(), table.size(), 1, file) != 1;
+				end = offsetTable + table.size();
+			}
+			else
+			{
+				std::string header = format == Format::Pfm ? headerPFM(width, height) : headerHDR(width, height);
+				dataStart = header.size();
+				failed = std::fputs(header.c_str(), file) < 0;
+			}
+			return !failed;
+		}
+
+		void writeTile(int x0, int y0, int tileWidth, int tileHeight, const float* rgb)
+		{
+			// Encode outside the lock; only the file position is shared
+			std::vector<unsigned char> block;
+			int pixelBytes = format == Format::Hdr ? 4 : 12;
+			if (format == Format::Exr)
+			{
+				Exr::putValue<int32_t>(block, x0 / tileSize);
+				Exr::putValue<int32_t>(block, y0 / tileSize);
+				Exr::putValue<int32_t>(block, 0);
+				Exr::putValue<int32_t>(block, 0);
+				Exr::putValue<int32_t>(block, tileWidth * tileHeight * 3 * sizeof(float));
+				for (int j = 0; j < tileHeight; j++)
+					Exr::putRow(block, rgb + j * tileWidth * 3, tileWidth);
+			}
+			else
+			{
+				block.resize(static_cast<size_t>(tileWidth) * tileHeight * pixelBytes);
+				for (int j = 0; j < tileHeight; j++)
+				{
+					const float* row = rgb + j * tileWidth * 3;
+					unsigned char* out = &block[j * tileWidth * pixelBytes];
+					if (format == Format::Pfm)
+						std::memcpy(out, row, tileWidth * pixelBytes);
+					else
+					{
+						for (int i = 0; i < tileWidth; i++)
+							toRGBE(row + i * 3, out + i * 4);
+					}
+				}
+			}
+
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!file || failed) return;
+
+			if (format == Format::Exr)
+			{
+				tileOffsets[(y0 / tileSize) * tilesX + x0 / tileSize] = end;
+				failed = seek(end) != 0 || std::fwrite(block.data(), block.size(), 1, file) != 1;
+				end += block.size();
+				return;
+			}
+
+			for (int j = 0; j < tileHeight && !failed; j++)
+			{
+				// PFM stores the bottom row first
+				int y = format == Format::Pfm ? height - 1 - (y0 + j) : y0 + j;
+				int64_t offset = dataStart + (static_cast<int64_t>(y) * width + x0) * pixelBytes;
+				failed = seek(offset) != 0
+					|| std::fwrite(&block[j * tileWidth * pixelBytes], tileWidth * pixelBytes, 1, file) != 1;
+			}
+		}
+
+		// Returns false if any write failed
+		bool close()
+		{
+			if (!file) return false;
+
+			if (format == Format::Exr && !failed)
+			{
+				std::vector<unsigned char> table;
+				for (auto offset : tileOffsets)
+					Exr::putValue<uint64_t>(table, offset);
+				failed = seek(offsetTable) != 0 || std::fwrite(table.data(), table.size(), 1, file) != 1;
+			}
+
+			failed = std::fclose(file) != 0 || failed;
+			file = nullptr;
+			return !failed;
+		}
+
+	private:
+		enum class Format { Exr, Pfm, Hdr };
+
+		Format format = Format::Exr;
+		std::FILE* file = nullptr;
+		std::mutex mutex;
+		bool failed = false;
+		int width = 0, height = 0;
+		int tileSize = 0, tilesX = 0, tilesY = 0;
+		int64_t dataStart = 0;					// PFM and HDR pixel data
+		int64_t offsetTable = 0;				// EXR tile offsets
+		int64_t end = 0;						// EXR end of written tiles
+		std::vector<uint64_t> tileOffsets;
+
+		int seek(int64_t offset)
+		{
+#ifdef _WIN32
+			return _fseeki64(file, offset, SEEK_SET);
+#else
+			return fseeko(file, static_cast<off_t>(offset), SEEK_SET);
+#endif
+		}
+	};
+}
@@ -1,266 +1,150 @@
 #include "raytracer.h"
 
-#include "bvh.h"
+#include "animation.h"
 #include "camera.h"
-#include "hittable.h"
-#include "hittable_list.h"
-#include "material.h"
-#include "quad.h"
-#include "sphere.h"
-#include "texture.h"
+#include "distributed.h"
+#include "render_options.h"
+#include "render_server.h"
+#include "scene_parser.h"
+#include "texture_cache.h"
+#include "timing.h"
 
-void bouncingSpheres() {
-
-	HittableList world;
-
-	auto checker = std::make_shared<CheckerTexture>(
-		0.32f, Color(0.2f, 0.3f, 0.1f), Color(0.9f, 0.9f, 0.9f));
-	world.add(std::make_shared<Sphere>(
-		Point3(0.0f, -1000.0f, 0.0f), 1000.0f, std::make_shared<Lambertian>(checker)));
-
-	// Add lots of random spheres
-	for (int a = -11; a < 11; a++) {
-		for (int b = -11; b < 11; b++) {
-			auto chooseMat = randomFloat();
-			Point3 center(a + 0.9f * randomFloat(), 0.2f, b + 0.9f * randomFloat());
-
-			if (mag(center - Point3(4.0f, 0.2f, 0.0f)) > 0.9f) {
-				std::shared_ptr<Material> sphereMaterial;
-
-				if (chooseMat < 0.8f) {
-					// Diffuse
-					auto albedo = Color::random() * Color::random();
-					sphereMaterial = std::make_shared<Lambertian>(albedo);
-					auto center2 = center + Vec3(0.0f, randomFloat(0.0f, 0.5f), 0.0f);
-					world.add(std::make_shared<Sphere>(center, center2, 0.2f, sphereMaterial));
-				}
-				else if (chooseMat < 0.95f) {
-					// Metal
-					auto albedo = Color::random();
-					auto fuzz = randomFloat(0.0f, 0.5f);
-					sphereMaterial = std::make_shared<Metal>(albedo, fuzz);
-					world.add(std::make_shared<Sphere>(center, 0.2f, sphereMaterial));
-				}
-				else {
-					// Glass
-					sphereMaterial = std::make_shared<Dielectric>(1.5f);
-					world.add(std::make_shared<Sphere>(center, 0.2f, sphereMaterial));
-				}
-			}
-		}
-	}
-
-	auto material1 = std::make_shared<Dielectric>(1.5f);
-	world.add(std::make_shared<Sphere>(Point3(0.0f, 1.0f, 0.0f), 1.0f, material1));
-
-	auto material2 = std::make_shared<Lambertian>(Color(0.4f, 0.2f, 0.1f));
-	world.add(std::make_shared<Sphere>(Point3(-4.0f, 1.0f, 0.0f), 1.0f, material2));
-
-	auto material3 = std::make_shared<Metal>(Color(0.7f, 0.6f, 0.5f), 0.0f);
-	world.add(std::make_shared<Sphere>(Point3(4.0f, 1.0f, 0.0f), 1.0f, material3));
-
-#define useBVH 1
-#if useBVH
-	world = HittableList(std::make_shared<BVHNode>(world));
-#endif
-
-	Camera camera;
-
-	camera.aspectRatio = 16.0f / 9.0f;
-	camera.imageWidth = 1200;
-	camera.samplesPerPixel = 500;
-	camera.maxDepth = 50;
-	camera.background = Color(0.7f, 0.8f, 1.0f);
-
-	camera.vFov = 20.0f;
-	camera.lookFrom = Point3(13.0f, 2.0f, 3.0f);
-	camera.lookAt = Point3(0.0f, 0.0f, 0.0f);
-	camera.viewUp = Vec3(0.0f, 1.0f, 0.0f);
-
-	camera.defocusAngle = 0.6f;
-	camera.focusDist = 10.0f;
-
-	camera.render(world);
-}
-
-void checkeredSpheres()
-{
-	HittableList world;
-
-	auto checker = std::make_shared<CheckerTexture>(
-		0.32f, Color(0.2f, 0.3f, 0.1f), Color(0.9f, 0.9f, 0.9f));
-
-	world.add(std::make_shared<Sphere>(
-		Point3(0.0f, -10.0f, 0.0f), 10.0f, std::make_shared<Lambertian>(checker)));
-	world.add(std::make_shared<Sphere>(
-		Point3(0.0f, 10.0f, 0.0f), 10.0f, std::make_shared<Lambertian>(checker)));
-
-	Camera camera;
-
-	camera.aspectRatio = 16.0f / 9.0f;
-	camera.imageWidth = 400;
-	camera.samplesPerPixel = 100;
-	camera.maxDepth = 50;
-	camera.background = Color(0.7f, 0.8f, 1.0f);
-
-	camera.vFov = 20;
-	camera.lookFrom = Point3(13.0f, 2.0f, 3.0f);
-	camera.lookAt = Point3(0.0f, 0.0f, 0.0f);
-	camera.viewUp = Vec3(0.0f, 1.0f, 0.0f);
-
-	camera.defocusAngle = 0;
-
-	camera.render(world);
-}
-
-void earth()
-{
-	auto earthTexture = std::make_shared<ImageTexture>("earthmap.jpg");
-	auto earthMaterial = std::make_shared<Lambertian>(earthTexture);
-	auto globe = std::make_shared<Sphere>(Point3(0.0f, 0.0f, 0.0f), 2.0f, earthMaterial);
-
-	Camera camera;
-
-	camera.aspectRatio = 16.0f / 9.0f;
-	camera.imageWidth = 400;
-	camera.samplesPerPixel = 100;
-	camera.maxDepth = 50;
-	camera.background = Color(0.7f, 0.8f, 1.0f);
-
-	camera.vFov = 20;
-	camera.lookFrom = Point3(0.0f, 0.0f, 12.0f);
-	camera.lookAt = Point3(0.0f, 0.0f, 0.0f);
-	camera.viewUp = Vec3(0.0f, 1.0f, 0.0f);
-
-	camera.defocusAngle = 0;
-
-	camera.render(HittableList(globe));
-}
-
-void quads()
-{
-	HittableList world;
-
-	auto leftRed = std::make_shared<Lambertian>(Color(1.0f, 0.2f, 0.2f));
-	auto backGreen = std::make_shared<Lambertian>(Color(0.2f, 1.0f, 0.2f));
-	auto rightBlue = std::make_shared<Lambertian>(Color(0.2f, 0.2f, 1.0f));
-	auto upperOrange = std::make_shared<Lambertian>(Color(1.0f, 0.5f, 0.0f));
-	auto lowerTeal = std::make_shared<Lambertian>(Color(0.2f, 0.8f, 0.8f));
-
-	world.add(std::make_shared<Quad>(Point3(-3.0f, -2.0f, 5.0f), Vec3(0.0f, 0.0f, -4.0f),
-		Vec3(0.0f, 4.0f, 0.0f), leftRed));
-	world.add(std::make_shared<Quad>(Point3(-2.0f, -2.0f, 0.0f), Vec3(4.0f, 0.0f, 0.0f),
-		Vec3(0.0f, 4.0f, 0.0f), backGreen));
-	world.add(std::make_shared<Quad>(Point3(3.0f, -2.0f, 1.0f), Vec3(0.0f, 0.0f, 4.0f),
-		Vec3(0.0f, 4.0f, 0.0f), rightBlue));
-	world.add(std::make_shared<Quad>(Point3(-2.0f, 3.0f, 1.0f), Vec3(4.0f, 0.0f, 0.0f),
-		Vec3(0.0f, 0.0f, 4.0f), upperOrange));
-	world.add(std::make_shared<Quad>(Point3(-2.0f, -3.0f, 5.0f), Vec3(4.0f, 0.0f, 0.0f),
-		Vec3(0.0f, 0.0f, -4.0f), lowerTeal));
-
-	Camera camera;
-
-	camera.aspectRatio = 1.0;
-	camera.imageWidth = 400;
-	camera.samplesPerPixel = 100;
-	camera.maxDepth = 50;
-	camera.background = Color(0.7f, 0.8f, 1.0f);
-
-	camera.vFov = 80;
-	camera.lookFrom = Point3(0.0f, 0.0f, 9.0f);
-	camera.lookAt = Point3(0.0f, 0.0f, 0.0f);
-	camera.viewUp = Vec3(0.0f, 1.0f, 0.0f);
-	camera.defocusAngle = 0;
-
-	camera.render(world);
-}
-
-void cornellBox()
-{
-	HittableList world;
-
-	auto red = std::make_shared<Lambertian>(Color(0.65f, 0.05f, 0.05f));
-	auto white = std::make_shared<Lambertian>(Color(0.73f, 0.73f, 0.73f));
-	auto green = std::make_shared<Lambertian>(Color(0.12f, 0.45f, 0.15f));
-	auto light = std::make_shared<DiffuseLight>(Color(15.0f, 15.0f, 15.0f));
-
-	world.add(std::make_shared<Quad>(Point3(555.0f, 0.0f, 0.0f), 
-		Vec3(0.0f, 555.0f, 0.0f), Vec3(0.0f, 0.0f, 555.0f), green));
-	world.add(std::make_shared<Quad>(Point3(0.0f, 0.0f, 0.0f), 
-		Vec3(0.0f, 555.0f, 0.0f), Vec3(0.0f, 0.0f, 555.0f), red));
-	world.add(std::make_shared<Quad>(Point3(343.0f, 554.0f, 332.0f), 
-		Vec3(-130.0f, 0.0f, 0.0f), Vec3(0, 0, -105), light));
-	world.add(std::make_shared<Quad>(Point3(0.0f, 0.0f, 0.0f), 
-		Vec3(555.0f, 0.0f, 0.0f), Vec3(0.0f, 0.0f, 555.0f), white));
-	world.add(std::make_shared<Quad>(Point3(555.0f, 555.0f, 555.0f), 
-		Vec3(-555.0f, 0.0f, 0.0f), Vec3(0.0f, 0.0f, -555.0f), white));
-	world.add(std::make_shared<Quad>(Point3(0.0f, 0.0f, 555.0f), 
-		Vec3(555.0f, 0.0f, 0.0f), Vec3(0.0f, 555.0f, 0.0f), white));
-
-	std::shared_ptr<Hittable> box1 = box(Point3(0.0f, 0.0f, 0.0f), Point3(165.0f, 330.0f, 165.0f), white);
-	box1 = std::make_shared<RotateY>(box1, 15.0f);
-	box1 = std::make_shared<Translate>(box1, Vec3(265.0f, 0.0f, 295.0f));
-	world.add(box1);
-
-	std::shared_ptr<Hittable> box2 = box(Point3(0.0f, 0.0f, 0.0f), Point3(165.0f, 165.0f, 165.0f), white);
-	box2 = std::make_shared<RotateY>(box2, -18.0f);
-	box2 = std::make_shared<Translate>(box2, Vec3(130.0f, 0.0f, 65.0f));
-	world.add(box2);
-
-	Camera camera;
-
-	camera.aspectRatio = 1.0f;
-	camera.imageWidth = 1200;
-	camera.samplesPerPixel = 500;
-	camera.maxDepth = 50;
-	camera.background = Color(0.0f, 0.0f, 0.0f);
-
-	camera.vFov = 40.0f;
-	camera.lookFrom = Point3(278.0f, 278.0f, -800.0f);
-	camera.lookAt = Point3(278.0f, 278.0f, 0.0f);
-	camera.viewUp = Vec3(0.0f, 1.0f, 0.0f);
-
-	camera.defocusAngle = 0.0f;
-
-	camera.render(world);
-}
+#include <cstring>
 
 int main(int argc, char* argv[])
 {
 	// Select the scene to render using command line arguments
-	if (argc < 2)
+	if (argc < 2 || std::strcmp(argv[1], "--help") == 0 || std::strcmp(argv[1], "-h") == 0)
 	{
-		// Prompt the user to rerun the program with a scene number if none is provided
-		std::cerr << "Provide an integer as the scene number to render.\n";
+		// Prompt the user to rerun the program with a scene if none is provided
+		std::cerr << usage;
 		return 1;
 	}
 
-	int scene;
-	try
+	// Server mode keeps scenes resident between renders requested over a socket
+	if (std::strcmp(argv[1], "--serve") == 0 && argc >= 3)
 	{
-		scene = std::stoi(argv[1]);
+		RenderServer server;
+		if (argc >= 5 && std::strcmp(argv[3], "--scene-cache") == 0 && !parsePositive(argv[4], server.cacheSize))
+		{
+			std::cerr << "Invalid value '" << argv[4] << "' for --scene-cache.\n";
+			return 1;
+		}
+		return server.run(argv[2]) ? 0 : 1;
 	}
-	catch (std::invalid_argument&)
+	if (std::strcmp(argv[1], "--connect") == 0 && argc >= 4)
 	{
-		std::cerr << "Invalid input. Please provide a valid integer.\n";
-		return 1;
+		std::vector<std::string> args(argv + 3, argv + argc);
+		if (args[0] != "status" && args[0] != "shutdown")
+			args.insert(args.begin(), "render");
+		return RenderServer::request(argv[2], args);
 	}
 
+	// Worker mode renders tiles for a coordinator started with --distribute
+	if (std::strcmp(argv[1], "--worker") == 0 && argc >= 3)
+	{
+		TileWorker worker;
+		if (argc >= 5 && std::strcmp(argv[3], "--threads") == 0 && !parsePositive(argv[4], worker.threadCount))
+		{
+			std::cerr << "Invalid value '" << argv[4] << "' for --threads.\n";
+			return 1;
+		}
+		return worker.run(argv[2]);
+	}
+
+	std::string sceneFile;
+	RenderOptions options;
+	if (!sceneArgument(argv[1], sceneFile, std::cerr) || !parseOptions(argc, argv, options, std::cerr))
+		return 1;
+
+	if (options.textureCacheMB > 0)
+		TextureCache::instance().setCapacity(static_cast<size_t>(options.textureCacheMB) << 20);
+
 	// Capture the render time of the selected scene
 	auto start = std::chrono::high_resolution_clock::now();
+	Timings::instance().reset();
+	if (!options.traceFile.empty())
+	{
+		Trace::instance().start();
+		Trace::instance().setThreadName("Main");
+	}
+
+	// The metrics file and endpoint cover the whole run, from scene load to the written image
+	RenderMetrics metrics;
+	MetricsReporter reporter(metrics, options.reporting());
 
-	switch (scene)
+	// Workers get the scene text and the options other than --distribute
+	TileCoordinator coordinator;
+	if (!options.distributeEndpoint.empty())
 	{
-	case 1: bouncingSpheres(); break;
-	case 2: checkeredSpheres(); break;
-	case 3: earth(); break;
-	case 4: quads(); break;
-	case 5: cornellBox(); break;
-	default: bouncingSpheres(); break;
+		std::string error;
+		if (options.aovs || options.denoise || options.frames > 0)
+		{
+			std::cerr << "AOVs, denoising and animations are not available with --distribute.\n";
+			return 1;
+		}
+		if (!coordinator.open(options.distributeEndpoint, error))
+		{
+			std::cerr << "Could not listen on " << options.distributeEndpoint << ": " << error << "\n";
+			return 1;
+		}
 	}
 
+	Scene scene;
+	std::string scenePath, sceneText;
+	if (!SceneParser::read(sceneFile, scenePath, sceneText, std::cerr)
+		|| !SceneParser::load(scenePath, sceneText, scene, options.bvh, std::cerr))
+		return 1;
+
+	options.apply(scene.camera);
+	scene.camera.reportTo(metrics);
+	if (!options.distributeEndpoint.empty())
+	{
+		std::vector<std::string> args;
+		for (int i = 0; i < argc; i++)
+		{
+			if (std::strcmp(argv[i], "--distribute") == 0) i++;
+			else args.push_back(argv[i]);
+		}
+		coordinator.setJob(args, scenePath, sceneText);
+		scene.camera.farm = &coordinator;
+	}
+	// Once per run, however many frames follow
+	Timings::instance().add("Scene setup", Timings::instance().elapsed());
+
+	if (options.frames > 0)
+	{
+		// Each frame renders with a fresh camera on the scene posed at the frame's time
+		Animator animator(scene, options.bvh);
+		for (int frame = 1; frame <= options.frames; frame++)
+		{
+			metrics.setPhase(RenderMetrics::Phase::Setup);
+			animator.setTime(static_cast<float>((frame - 1) / options.fps));
+			Camera camera;
+			static_cast<CameraSettings&>(camera) = scene.camera;
+			camera.outputFile = options.frameOutput(frame);
+			camera.reportTo(metrics);
+			camera.render(scene.world);
+		}
+		std::clog << "Rendered " << options.frames << " frames, rebuilding the BVH "
+			<< animator.rebuilds() << " times\n";
+	}
+	else
+		scene.camera.render(scene.world);
+	metrics.setPhase(RenderMetrics::Phase::Done);
+	reporter.stop();
+
 	auto end = std::chrono::high_resolution_clock::now();
 
 	std::chrono::duration<double> duration = end - start;
+	Timings::instance().print(std::clog);
 	std::clog << "Render time: " << duration.count() << " s\n";
-}
\ No newline at end of file
+
+	if (!options.traceFile.empty())
+	{
+		if (Trace::instance().write(options.traceFile))
+			std::clog << "Trace saved to " << options.traceFile << "\n";
+		else
+			std::cerr << "Failed to save trace to " << options.traceFile << "\n";
+	}
+}
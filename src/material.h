@@ -3,80 +3,99 @@
 #include "hittable.h"
 #include "texture.h"
 
-class Material 
+#include <cstdint>
+
+// Materials are a closed set of types dispatched by a tag over parameters stored inline,
+// so shading a bounce does not go through a virtual call. The derived classes below only
+// fill in the parameters; CustomMaterial is the extension point for anything else.
+class Material
 {
 public:
-	virtual ~Material() = default;
+	enum class Type : uint8_t
+	{
+		Lambertian,
+		Metal,
+		Dielectric,
+		DiffuseLight,
+		Custom
+	};
+
+	Type type() const { return kind; }
+
+	// Unique per material of a scene, numbered from 0 in the order the scene defines them, so
+	// the same scene has the same ids in any process. Materials made outside a scene are 0.
+	uint32_t id() const { return materialId; }
+	void setId(uint32_t id) { materialId = id; }
+
+	// Only emissive materials need emitted() to be evaluated
+	bool isEmissive() const { return emissive; }
+
+	Color emitted(float u, float v, const Point3& p) const;
+
+	bool scatter(
+		const Ray& rayIn, const HitRecord& hitRecord, Color& attenuation, Ray& scattered
+	) const;
+
+	// Surface color independent of lighting, for the albedo AOV
+	Color baseColor(const HitRecord& hitRecord) const;
+
+protected:
+	Type kind;
+	bool emissive;
+	Color albedo;						// Constant reflectance or emission
+	float param = 0.0f;					// Fuzz of Metal, refraction index of Dielectric
+	std::shared_ptr<Texture> texture;	// Varying reflectance or emission, null if constant
 
-	virtual Color emitted(float u, float v, const Point3& p) const
+	Material(Type kind, bool emissive) : kind(kind), emissive(emissive) {}
+
+	void setTexture(std::shared_ptr<Texture> tex)
 	{
-		return Color(0.0f, 0.0f, 0.0f);
+		// Solid colors are stored inline so that shading skips the texture entirely
+		if (tex->isConstant())
+			albedo = tex->constant();
+		else
+			texture = tex;
 	}
 
-	virtual bool scatter(
-		const Ray& rayIn, const HitRecord& hitRecord, Color& attenuation, Ray& scattered
-	) const 
+	Color textureValue(const HitRecord& record) const
 	{
-		return false;
+		return texture ? texture->value(record.u, record.v, record.p, record.filterU, record.filterV)
+			: albedo;
 	}
-};
 
-class Lambertian : public Material 
-{
 private:
-	std::shared_ptr<Texture> texture;
+	uint32_t materialId = 0;
 
-public:
-	Lambertian(const Color& albedo) : texture(std::make_shared<SolidColor>(albedo)) {}
-	Lambertian(std::shared_ptr<Texture> texture) : texture(texture) {}
-
-	bool scatter(
+	bool scatterLambertian(
 		const Ray& rayIn, const HitRecord& record, Color& attenuation, Ray& scattered
-	) const override 
+	) const
 	{
 		auto scatterDir = record.normal + randomUnitVector();
 
 		if (scatterDir.nearZero())
 			scatterDir = record.normal;
-		
+
 		scattered = Ray(record.p, scatterDir, rayIn.time);
-		attenuation = texture->value(record.u, record.v, record.p);
+		attenuation = textureValue(record);
 		return true;
 	}
-};
 
-class Metal : public Material {
-private:
-	Color albedo;
-	float fuzz;
-
-public:
-	Metal(const Color& albedo, float fuzz) : albedo(albedo), fuzz(fuzz < 1 ? fuzz : 1) {}
-
-	bool scatter(
+	bool scatterMetal(
 		const Ray& rayIn, const HitRecord& record, Color& attenuation, Ray& scattered
-	) const override 
+	) const
 	{
 		Vec3 reflected = reflect(rayIn.dir, record.normal);
-		reflected = normalize(reflected) + (fuzz * randomUnitVector());
+		reflected = normalize(reflected) + (param * randomUnitVector());
 		scattered = Ray(record.p, reflected, rayIn.time);
 		attenuation = albedo;
 		return (dot(scattered.dir, record.normal) > 0);
 	}
-};
-
-class Dielectric : public Material 
-{
-private:
-	float refractionIndex;
-
-public:
-	Dielectric(float refractionIndex) : refractionIndex(refractionIndex) {}
 
-	bool scatter(
+	bool scatterDielectric(
 		const Ray& rayIn, const HitRecord& record, Color& attenuation, Ray& scattered
-	) const override 
+	) const
 	{
+		float refractionIndex = param;
 		float refractionRatio = record.frontFace ? (1.0f / refractionIndex) : refractionIndex;
 
 		Vec3 unitDir = normalize(rayIn.dir);
@@ -86,11 +105,11 @@ public:
 		bool cannotRefract = refractionRatio * sinTheta > 1.0f;
 		Vec3 direction;
 
-		if (cannotRefract || reflectance(cosTheta, refractionRatio) > randomFloat()) 
+		if (cannotRefract || reflectance(cosTheta, refractionRatio) > randomFloat())
 		{
 			direction = reflect(unitDir, record.normal);
 		}
-		else 
+		else
 		{
 			direction = refract(unitDir, record.normal, refractionRatio);
 		}
@@ -100,8 +119,7 @@ public:
 		return true;
 	}
 
-private:
-	static float reflectance(float cosine, float refractionRatio) 
+	static float reflectance(float cosine, float refractionRatio)
 	{
 		float r0 = (1 - refractionRatio) / (1 + refractionRatio);
 		r0 = r0 * r0;
@@ -109,17 +127,111 @@ private:
 	}
 };
 
-class DiffuseLight : public Material 
+class Lambertian : public Material
 {
-private:
-	std::shared_ptr<Texture> tex;
+public:
+	Lambertian(const Color& albedo) : Material(Type::Lambertian, false)
+	{
+		this->albedo = albedo;
+	}
+	Lambertian(std::shared_ptr<Texture> tex) : Material(Type::Lambertian, false)
+	{
+		setTexture(tex);
+	}
+};
 
+class Metal : public Material
+{
 public:
-	DiffuseLight(std::shared_ptr<Texture> tex) : tex(tex) {}
-	DiffuseLight(const Color& emit) : tex(std::make_shared<SolidColor>(emit)) {}
+	Metal(const Color& albedo, float fuzz) : Material(Type::Metal, false)
+	{
+		this->albedo = albedo;
+		param = fuzz < 1 ? fuzz : 1;
+	}
+};
+
+class Dielectric : public Material
+{
+public:
+	Dielectric(float refractionIndex) : Material(Type::Dielectric, false)
+	{
+		param = refractionIndex;
+	}
+};
+
+class DiffuseLight : public Material
+{
+public:
+	DiffuseLight(std::shared_ptr<Texture> tex) : Material(Type::DiffuseLight, true)
+	{
+		setTexture(tex);
+	}
+	DiffuseLight(const Color& emit) : Material(Type::DiffuseLight, true)
+	{
+		albedo = emit;
+	}
+};
+
+// Base for materials outside the closed set. These pay for one virtual call per bounce.
+class CustomMaterial : public Material
+{
+public:
+	CustomMaterial(bool emissive = false) : Material(Type::Custom, emissive) {}
+	virtual ~CustomMaterial() = default;
+
+	virtual Color emitCustom(float u, float v, const Point3& p) const
+	{
+		return Color(0.0f, 0.0f, 0.0f);
+	}
 
-	color emitted(float u, float v, const Point3& p) const override
+	virtual bool scatterCustom(
+		const Ray& rayIn, const HitRecord& hitRecord, Color& attenuation, Ray& scattered
+	) const
+	{
+		return false;
+	}
+
+	virtual Color baseColorCustom(const HitRecord& hitRecord) const
+	{
+		return Color(1.0f, 1.0f, 1.0f);
+	}
+};
+
+inline Color Material::emitted(float u, float v, const Point3& p) const
+{
+	switch (kind)
+	{
+	case Type::DiffuseLight: return texture ? texture->value(u, v, p) : albedo;
+	case Type::Custom: return static_cast<const CustomMaterial*>(this)->emitCustom(u, v, p);
+	default: return Color(0.0f, 0.0f, 0.0f);
+	}
+}
+
+inline bool Material::scatter(
+	const Ray& rayIn, const HitRecord& hitRecord, Color& attenuation, Ray& scattered
+) const
+{
+	switch (kind)
+	{
+	case Type::Lambertian: return scatterLambertian(rayIn, hitRecord, attenuation, scattered);
+	case Type::Metal: return scatterMetal(rayIn, hitRecord, attenuation, scattered);
+	case Type::Dielectric: return scatterDielectric(rayIn, hitRecord, attenuation, scattered);
+	case Type::Custom:
+		return static_cast<const CustomMaterial*>(this)->scatterCustom(
+			rayIn, hitRecord, attenuation, scattered);
+	default: return false;
+	}
+}
+
+inline Color Material::baseColor(const HitRecord& hitRecord) const
+{
+	// Clear dielectrics report white, as denoisers expect
+	switch (kind)
 	{
-		return tex->value(u, v, p);
+	case Type::Lambertian:
+	case Type::DiffuseLight: return textureValue(hitRecord);
+	case Type::Metal: return albedo;
+	case Type::Custom: return static_cast<const CustomMaterial*>(this)->baseColorCustom(hitRecord);
+	default: return Color(1.0f, 1.0f, 1.0f);
 	}
-};
\ No newline at end of file
+}
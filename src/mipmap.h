@@ -0,0 +1,429 @@
+#pragma once
+
+#include "rtw_stb_image.h"
+#include "texture_cache.h"
+#include "thread_pool.h"
+#include "timing.h"
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+// Image pyramid sampled through the texture cache. The first time an image is used, it is
+// decoded, box filtered into mip levels and written as a tiled file to the tiled texture
+// directory: RTW_TEXTURE_CACHE when set, otherwise the user's cache directory (e.g.
+// ~/.cache/raytracer), never the directory of the source images. Later runs open the tiled
+// file directly, and tiles are only read from disk when a lookup touches them. The tiled file
+// is named after the source's absolute path and remade when the source's size or
+// modification time differs from the one it was made from.
+class MipMap
+{
+public:
+	MipMap() {}
+
+	MipMap(const MipMap&) = delete;
+	MipMap& operator=(const MipMap&) = delete;
+
+	// Returns false, printing why, if the image cannot be read; lookups then return black
+	bool load(const char* filename)
+	{
+		std::string source = rtw_image::resolve(filename);
+		if (source.empty())
+		{
+			std::cerr << "ERROR: Could not load image file '" << filename << "'.\n";
+			return false;
+		}
+
+		SourceStamp stamp = sourceStamp(source);
+		const std::string& directory = tiledDirectory();
+		if (directory.empty())
+		{
+			std::cerr << "ERROR: Could not create a directory for tiled textures; set RTW_TEXTURE_CACHE to a writable one.\n";
+			return false;
+		}
+		std::string tiledPath = directory + tiledName(source);
+		if (openTiled(tiledPath, stamp)) return true;
+
+		// Convert the image, then read it back through the cache like any other tiled file
+		rtw_image image;
+		if (!image.load(source))
+		{
+			std::cerr << "ERROR: Could not load image file '" << filename << "'.\n";
+			return false;
+		}
+
+		if (writeTiled(tiledPath, image, stamp) && openTiled(tiledPath, stamp)) return true;
+		std::cerr << "ERROR: Could not write tiled texture " << tiledPath << " for '" << filename << "'.\n";
+		return false;
+	}
+
+	int width() const { return levels.empty() ? 0 : levels[0].width; }
+	int height() const { return levels.empty() ? 0 : levels[0].height; }
+	int levelCount() const { return static_cast<int>(levels.size()); }
+
+	Color lookup(float u, float v, float filterU, float filterV) const
+	{
+		// Trilinear lookup where the filter widths are the footprint of the sample in [0, 1]
+		// texture coordinates. A width of zero samples the full resolution level.
+		float texels = std::max(filterU * width(), filterV * height());
+		float level = texels > 1.0f ? std::log2(texels) : 0.0f;
+
+		int last = levelCount() - 1;
+		if (level >= last) return bilinear(last, u, v);
+
+		int level0 = static_cast<int>(level);
+		float t = level - level0;
+		Color c0 = bilinear(level0, u, v);
+		if (t <= 0.0f) return c0;
+
+		Color c1 = bilinear(level0 + 1, u, v);
+		return (1.0f - t) * c0 + t * c1;
+	}
+
+private:
+	std::shared_ptr<TextureFile> file;
+	std::vector<TiledLevel> levels;
+
+	struct SourceStamp
+	{
+		uint64_t size = 0;
+		uint64_t time = 0;		// Modification time in nanoseconds
+	};
+
+	// Scanline copy of a level, only used while writing the tiled file
+	struct Level
+	{
+		int width = 0;
+		int height = 0;
+		std::vector<unsigned char> texels;
+
+		const unsigned char* texel(int x, int y) const
+		{
+			x = std::min(x, width - 1);
+			y = std::min(y, height - 1);
+			return &texels[(y * width + x) * 3];
+		}
+	};
+
+	Color texel(int level, int x, int y) const
+	{
+		const TiledLevel& l = levels[level];
+		x = std::min(std::max(x, 0), l.width - 1);
+		y = std::min(std::max(y, 0), l.height - 1);
+
+		uint64_t tileIndex = l.firstTile
+			+ static_cast<uint64_t>(y / textureTileSize) * l.tilesX + x / textureTileSize;
+		const unsigned char* pixel = TextureCache::instance().tile(*file, tileIndex)
+			->texel(x % textureTileSize, y % textureTileSize);
+
+		auto colorScale = 1.0f / 255.0f;
+		return Color(colorScale * pixel[0], colorScale * pixel[1], colorScale * pixel[2]);
+	}
+
+	Color bilinear(int level, float u, float v) const
+	{
+		// Texel centers sit at half-integer coordinates
+		float x = u * levels[level].width - 0.5f;
+		float y = v * levels[level].height - 0.5f;
+		int x0 = static_cast<int>(std::floor(x));
+		int y0 = static_cast<int>(std::floor(y));
+		float fx = x - x0;
+		float fy = y - y0;
+
+		return (1.0f - fx) * (1.0f - fy) * texel(level, x0, y0)
+			+ fx * (1.0f - fy) * texel(level, x0 + 1, y0)
+			+ (1.0f - fx) * fy * texel(level, x0, y0 + 1)
+			+ fx * fy * texel(level, x0 + 1, y0 + 1);
+	}
+
+	bool openTiled(const std::string& path, const SourceStamp& stamp)
+	{
+		// Only accept tiled files made from the source as it is now
+		std::FILE* tiled = std::fopen(path.c_str(), "rb");
+		if (!tiled) return false;
+
+		TiledFileHeader header;
+		std::vector<TiledLevel> fileLevels;
+		bool valid = TextureCache::readLevels(tiled, header, fileLevels)
+			&& header.sourceSize == stamp.size && header.sourceTime == stamp.time;
+		std::fclose(tiled);
+		if (!valid) return false;
+
+		file = TextureCache::instance().open(path, levels);
+		return file != nullptr;
+	}
+
+	static bool writeTiled(const std::string& path, const rtw_image& image, const SourceStamp& stamp)
+	{
+		// Build the pyramid in memory
+		std::vector<Level> pyramid(1);
+		pyramid[0].width = image.width();
+		pyramid[0].height = image.height();
+		pyramid[0].texels.resize(pyramid[0].width * pyramid[0].height * 3);
+		for (int y = 0; y < image.height(); y++)
+		{
+			for (int x = 0; x < image.width(); x++)
+			{
+				const unsigned char* pixel = image.pixel_data(x, y);
+				std::copy(pixel, pixel + 3, &pyramid[0].texels[(y * image.width() + x) * 3]);
+			}
+		}
+		while (pyramid.back().width > 1 || pyramid.back().height > 1)
+			pyramid.push_back(downsample(pyramid.back()));
+
+		// Write to a temporary file first so a reader never sees a partial file. Its name is
+		// unique to this process and load, so concurrent writers of the same texture, such as
+		// distributed workers sharing a directory, each finish their own file.
+		std::string tempPath = temporaryPath(path);
+		std::FILE* file = std::fopen(tempPath.c_str(), "wb");
+		if (!file) return false;
+
+		TiledFileHeader header = { { 'R', 'T', 'T', '2' }, textureTileSize,
+			static_cast<uint32_t>(pyramid.size()), 0, stamp.size, stamp.time };
+		bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+		for (const auto& level : pyramid)
+		{
+			uint32_t size[2] = { static_cast<uint32_t>(level.width), static_cast<uint32_t>(level.height) };
+			ok = ok && std::fwrite(size, sizeof(size), 1, file) == 1;
+		}
+
+		// Tiles are written row by row; edge tiles repeat the last texel of the level
+		TextureTile tile;
+		for (const auto& level : pyramid)
+		{
+			for (int ty = 0; ty < level.height; ty += textureTileSize)
+			{
+				for (int tx = 0; tx < level.width; tx += textureTileSize)
+				{
+					for (int y = 0; y < textureTileSize; y++)
+					{
+						for (int x = 0; x < textureTileSize; x++)
+						{
+							const unsigned char* pixel = level.texel(tx + x, ty + y);
+							std::copy(pixel, pixel + 3, &tile.texels[(y * textureTileSize + x) * 3]);
+						}
+					}
+					ok = ok && std::fwrite(tile.texels, textureTileBytes, 1, file) == 1;
+				}
+			}
+		}
+
+		ok = std::fclose(file) == 0 && ok;
+#ifdef _WIN32
+		// rename does not replace an existing file here
+		if (ok) std::remove(path.c_str());
+#endif
+		if (!ok || std::rename(tempPath.c_str(), path.c_str()) != 0)
+		{
+			std::remove(tempPath.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	static Level downsample(const Level& src)
+	{
+		// Average each 2x2 block; odd edges repeat their last row or column
+		Level dst;
+		dst.width = std::max(1, src.width / 2);
+		dst.height = std::max(1, src.height / 2);
+		dst.texels.resize(dst.width * dst.height * 3);
+
+		for (int y = 0; y < dst.height; y++)
+		{
+			for (int x = 0; x < dst.width; x++)
+			{
+				const unsigned char* p00 = src.texel(2 * x, 2 * y);
+				const unsigned char* p10 = src.texel(2 * x + 1, 2 * y);
+				const unsigned char* p01 = src.texel(2 * x, 2 * y + 1);
+				const unsigned char* p11 = src.texel(2 * x + 1, 2 * y + 1);
+				for (int c = 0; c < 3; c++)
+				{
+					int sum = p00[c] + p10[c] + p01[c] + p11[c];
+					dst.texels[(y * dst.width + x) * 3 + c] = static_cast<unsigned char>((sum + 2) / 4);
+				}
+			}
+		}
+
+		return dst;
+	}
+
+	static SourceStamp sourceStamp(const std::string& path)
+	{
+		SourceStamp stamp;
+		struct stat info;
+		if (stat(path.c_str(), &info) != 0) return stamp;
+
+		stamp.size = static_cast<uint64_t>(info.st_size);
+#ifdef __linux__
+		stamp.time = static_cast<uint64_t>(info.st_mtim.tv_sec) * 1000000000u + info.st_mtim.tv_nsec;
+#else
+		stamp.time = static_cast<uint64_t>(info.st_mtime) * 1000000000u;
+#endif
+		return stamp;
+	}
+
+	static std::string temporaryPath(const std::string& path)
+	{
+		static std::atomic<unsigned> count(0);
+#ifdef _WIN32
+		int pid = _getpid();
+#else
+		int pid = static_cast<int>(getpid());
+#endif
+		return path + "." + std::to_string(pid) + "." + std::to_string(count++) + ".tmp";
+	}
+
+	static std::string baseName(const std::string& path)
+	{
+		auto slash = path.find_last_of("/\\");
+		return slash == std::string::npos ? path : path.substr(slash + 1);
+	}
+
+	// The source's file name followed by a hash of its absolute path, so images of the same
+	// name in different directories get their own tiled files
+	static std::string tiledName(const std::string& source)
+	{
+		std::string path = source;
+#ifdef _WIN32
+		char resolved[_MAX_PATH];
+		if (_fullpath(resolved, source.c_str(), sizeof(resolved))) path = resolved;
+#else
+		char resolved[PATH_MAX];
+		if (realpath(source.c_str(), resolved)) path = resolved;
+#endif
+		// FNV-1a
+		uint64_t hash = 0xcbf29ce484222325ull;
+		for (char c : path)
+		{
+			hash ^= static_cast<unsigned char>(c);
+			hash *= 0x100000001b3ull;
+		}
+		char suffix[24];
+		std::snprintf(suffix, sizeof(suffix), ".%016llx.rtt", static_cast<unsigned long long>(hash));
+		return baseName(source) + suffix;
+	}
+
+	// Directory for tiled files, created on first use and ending with a slash, or empty if
+	// there is no usable one
+	static const std::string& tiledDirectory()
+	{
+		static const std::string directory = []() {
+			std::string dir;
+			if (const char* configured = std::getenv("RTW_TEXTURE_CACHE")) dir = configured;
+#ifdef _WIN32
+			else if (const char* local = std::getenv("LOCALAPPDATA")) dir = std::string(local) + "\\raytracer";
+#else
+			else if (const char* cache = std::getenv("XDG_CACHE_HOME")) dir = std::string(cache) + "/raytracer";
+			else if (const char* home = std::getenv("HOME")) dir = std::string(home) + "/.cache/raytracer";
+			else dir = "/tmp/raytracer";
+#endif
+			if (dir.empty() || !makeDirectories(dir)) return std::string();
+			return dir + "/";
+		}();
+		return directory;
+	}
+
+	// Creates a directory and any missing parents; true if it exists afterwards
+	static bool makeDirectories(const std::string& dir)
+	{
+		for (size_t slash = dir.find_first_of("/\\", 1); ; slash = dir.find_first_of("/\\", slash + 1))
+		{
+			std::string part = dir.substr(0, slash);
+#ifdef _WIN32
+			_mkdir(part.c_str());
+#else
+			mkdir(part.c_str(), 0755);
+#endif
+			if (slash == std::string::npos) break;
+		}
+		struct stat info;
+		return stat(dir.c_str(), &info) == 0 && (info.st_mode & S_IFMT) == S_IFDIR;
+	}
+};
+
+// Loads image textures on a pool of threads so that decoding overlaps the rest of scene
+// setup. Each file is loaded once however many textures refer to it, and is released, closing
+// its tiled file, with the last texture that uses it. Pyramids must not be sampled before
+// wait() returns.
+class TextureLoader
+{
+public:
+	static std::shared_ptr<MipMap> load(const char* filename)
+	{
+		TextureLoader& loader = instance();
+		std::lock_guard<std::mutex> lock(loader.mutex);
+
+		auto found = loader.images.find(filename);
+		if (found != loader.images.end())
+		{
+			if (auto mips = found->second.lock()) return mips;
+		}
+
+		// Forget pyramids whose scenes have gone before adding one
+		for (auto image = loader.images.begin(); image != loader.images.end();)
+		{
+			if (image->second.expired())
+				image = loader.images.erase(image);
+			else
+				++image;
+		}
+
+		auto mips = std::make_shared<MipMap>();
+		std::string name(filename);
+		loader.images[name] = mips;
+		loader.pending.push_back(loader.pool().submit([mips, name]() {
+			ScopedTimer timer("Texture load (async)");
+			return mips->load(name.c_str());
+		}));
+		return mips;
+	}
+
+	// Blocks until every submitted load has finished; returns false if any image failed
+	static bool wait()
+	{
+		TextureLoader& loader = instance();
+		std::vector<std::future<bool>> loads;
+		{
+			std::lock_guard<std::mutex> lock(loader.mutex);
+			loads.swap(loader.pending);
+		}
+		bool loaded = true;
+		for (auto& load : loads)
+			loaded = load.get() && loaded;
+		return loaded;
+	}
+
+private:
+	std::mutex mutex;
+	std::map<std::string, std::weak_ptr<MipMap>> images;
+	std::vector<std::future<bool>> pending;
+	std::unique_ptr<ThreadPool> workers;
+
+	static TextureLoader& instance()
+	{
+		static TextureLoader loader;
+		return loader;
+	}
+
+	ThreadPool& pool()
+	{
+		// Started on first use, so scenes without image textures spawn no threads
+		if (!workers) workers.reset(new ThreadPool(0, "Texture"));
+		return *workers;
+	}
+};
@@ -13,6 +13,7 @@ private:
 	AABB bbox;
 	Vec3 normal;
 	float d;
+	uint32_t primId;
 
 public:
 	Quad(const Point3& q, const Vec3& u, const Vec3& v, std::shared_ptr<Material> mat)
@@ -24,6 +25,7 @@ public:
 		w = n / dot(n, n);
 
 		setBoundingBox();
+		primId = registerPrimitive(this);
 	}
 
 	virtual void setBoundingBox()
@@ -34,8 +36,10 @@ public:
 		bbox = AABB(bboxDiagonal1, bboxDiagonal2);
 	}
 
-	bool hit(const Ray& ray, Interval rayT, HitRecord& record) const override
+	bool hit(const Ray& ray, Interval rayT, RayHit& rayHit) const override
 	{
+		Stats::primitiveTests(1);
+
 		// Check if ray is parallel to the plane
 		float denominator = dot(normal, ray.dir);
 		if (std::fabs(denominator) < 1e-8f) 
@@ -51,27 +55,39 @@ public:
 		Point3 planarHitPoint = intersection - q;
 		float alpha = dot(w, cross(planarHitPoint, v));
 		float beta = dot(w, cross(u, planarHitPoint));
-		if (!isInterior(alpha, beta, record))
+		if (!isInterior(alpha, beta))
 			return false;
 
-		// Set the rest of the hit record if the ray hits the quad
-		record.t = t;
-		record.p = intersection;
-		record.mat = mat;
-		record.setFaceNormal(ray, normal);
+		rayHit.t = t;
+		rayHit.primId = primId;
+		rayHit.instId = noInstance;
+		rayHit.setBarycentrics(alpha, beta);
 
+		Stats::primitiveHit();
 		return true;
 	}
 
-	virtual bool isInterior(float a, float b, HitRecord& record) const
+	void surface(const Ray& ray, const RayHit& rayHit, HitRecord& record) const override
+	{
+		record.t = rayHit.t;
+		record.p = ray.at(rayHit.t);
+		record.u = rayHit.barycentric0();
+		record.v = rayHit.barycentric1();
+		record.dpdu = u;
+		record.dpdv = v;
+		record.mat = mat.get();
+		record.setFaceNormal(ray, normal);
+	}
+
+	virtual bool isInterior(float a, float b) const
 	{
 		Interval unitInterval = Interval(0.0f, 1.0f);
-		if (!unitInterval.contains(a) || !unitInterval.contains(b))
-			return false;
+		return unitInterval.contains(a) && unitInterval.contains(b);
+	}
 
-		record.u = a;
-		record.v = b;
-		return true;
+	std::shared_ptr<Hittable> replicate(Replicas&) const override
+	{
+		return std::make_shared<Quad>(*this);
 	}
 
 	AABB boundingBox() const override { return bbox; }
@@ -7,11 +7,29 @@ struct Ray {
 	Vec3 dir;
 	float time;
 
-	Ray() : origin(Point3()), dir(Vec3()), time(0) {}
-	Ray(const Point3& origin, const Vec3& dir, float time) : origin(origin), dir(dir), time(time) {}
+	// Cached per ray for slab tests: the reciprocal direction and whether each component
+	// of the direction is negative, which selects the near and far planes of a box
+	Vec3 invDir;
+	int sign[3];
+
+	Ray() : Ray(Point3(), Vec3(), 0) {}
+	Ray(const Point3& origin, const Vec3& dir, float time) : origin(origin), dir(dir), time(time)
+	{
+		invDir = Vec3(1.0f / dir.x, 1.0f / dir.y, 1.0f / dir.z);
+		sign[0] = invDir.x < 0.0f;
+		sign[1] = invDir.y < 0.0f;
+		sign[2] = invDir.z < 0.0f;
+	}
 	Ray(const Point3& origin, const Vec3& dir) : Ray(origin, dir, 0) {}
 
 	Point3 at(float t) const {
 		return origin + t * dir;
 	}
-};
\ No newline at end of file
+};
+
+// Offset rays one pixel to the right and one pixel down from a camera ray, used to estimate
+// the footprint of the pixel on the surface it hits
+struct RayDifferential {
+	Point3 rxOrigin, ryOrigin;
+	Vec3 rxDir, ryDir;
+};
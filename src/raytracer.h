@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cmath>
+#include <cstdint>
 #include <iostream>
 #include <string>
 #include <limits>
@@ -19,16 +20,25 @@ inline float degreesToRadians(float degrees) {
 	return degrees * pi / 180.0f;
 }
 
-inline float randomFloat() {
+// Each thread draws from its own generator, so threads never contend for it. Seeding it
+// makes the numbers that thread draws next reproducible.
+inline std::mt19937& randomGenerator() {
 	thread_local std::mt19937 generator;
+	return generator;
+}
+
+inline void seedRandom(uint32_t seed) {
+	randomGenerator().seed(seed);
+}
+
+inline float randomFloat() {
 	std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
-	return distribution(generator);
+	return distribution(randomGenerator());
 }
 
 inline float randomFloat(float min, float max) {
-	thread_local std::mt19937 generator;
 	std::uniform_real_distribution<float> distribution(min, max);
-	return distribution(generator);
+	return distribution(randomGenerator());
 }
 
 inline int randomInt(int min, int max) {
@@ -0,0 +1,350 @@
+#pragma once
+
+#include "socket.h"
+#include "timing.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+// Live progress of a render. Workers add to relaxed atomics once per tile without locking, so
+// reporting never stalls rendering; a lock only keeps snapshots from reading the counters
+// while begin() replaces them for the next frame. The phase covers the whole run around the
+// tiles, so observers can tell a scene still loading from a finished render.
+class RenderMetrics
+{
+public:
+	enum class Phase
+	{
+		Setup,								// Loading the scene, building the BVH, waiting for textures
+		Rendering,
+		Writing,							// Tiles finished; denoising and writing the image
+		Done
+	};
+
+	struct Snapshot
+	{
+		Phase phase = Phase::Setup;
+		bool done = false;					// All tiles finished
+		double elapsed = 0.0;				// Seconds since the render started, or the run before it
+		int tilesDone = 0;
+		int tileCount = 0;
+		uint64_t pixelsDone = 0;
+		uint64_t pixelCount = 0;
+		uint64_t cameraRays = 0;			// One per sample
+		uint64_t secondaryRays = 0;
+		uint64_t peakResident = 0;			// Bytes, or 0 where unknown
+		std::vector<int> workerTiles;
+		std::vector<double> workerBusy;		// Seconds spent rendering tiles
+
+		double rate(uint64_t count) const { return elapsed > 0.0 ? count / elapsed : 0.0; }
+
+		// Seconds left at the average rate so far, or negative before the first tile
+		double eta() const
+		{
+			if (done) return 0.0;
+			if (pixelsDone == 0) return -1.0;
+			return elapsed * (pixelCount - pixelsDone) / pixelsDone;
+		}
+
+		std::string json() const
+		{
+			std::ostringstream out;
+			out.setf(std::ios::fixed);
+			out.precision(3);
+			static const char* phases[] = { "setup", "rendering", "writing", "done" };
+			out << "{\n\t\"state\": \"" << phases[static_cast<int>(phase)] << "\",\n"
+				<< "\t\"elapsed_seconds\": " << elapsed << ",\n"
+				<< "\t\"eta_seconds\": ";
+			if (eta() < 0.0) out << "null"; else out << eta();
+			out << ",\n\t\"tiles_done\": " << tilesDone << ",\n"
+				<< "\t\"tiles_total\": " << tileCount << ",\n"
+				<< "\t\"pixels_done\": " << pixelsDone << ",\n"
+				<< "\t\"pixels_total\": " << pixelCount << ",\n"
+				<< "\t\"samples\": " << cameraRays << ",\n"
+				<< "\t\"samples_per_second\": " << rate(cameraRays) << ",\n"
+				<< "\t\"camera_rays\": " << cameraRays << ",\n"
+				<< "\t\"secondary_rays\": " << secondaryRays << ",\n"
+				<< "\t\"rays_per_second\": " << rate(cameraRays + secondaryRays) << ",\n"
+				<< "\t\"peak_rss_bytes\": " << peakResident << ",\n"
+				<< "\t\"threads\": [";
+			for (size_t i = 0; i < workerTiles.size(); i++)
+			{
+				out << (i > 0 ? ",\n\t\t" : "\n\t\t") << "{\"tiles\": " << workerTiles[i]
+					<< ", \"busy_seconds\": " << workerBusy[i]
+					<< ", \"utilization\": " << (elapsed > 0.0 ? workerBusy[i] / elapsed : 0.0) << "}";
+			}
+			out << (workerTiles.empty() ? "]\n}\n" : "\n\t]\n}\n");
+			return out.str();
+		}
+	};
+
+	// Resets the counters for a render of tileCount tiles on workerCount threads
+	void begin(int tileCount, uint64_t pixelCount, int workerCount)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		this->tileCount = tileCount;
+		this->pixelCount = pixelCount;
+		allocateWorkers(workerCount);
+		tilesDone.store(0);
+		pixelsDone.store(0);
+		cameraRays.store(0);
+		secondaryRays.store(0);
+		start = Timings::Clock::now();
+		finished.store(false);
+		setPhase(Phase::Rendering);
+	}
+
+	void tileDone(int worker, uint64_t pixels, uint64_t samples, uint64_t secondary, Timings::Clock::duration busy)
+	{
+		Worker& w = workers[worker];
+		w.tiles.fetch_add(1, std::memory_order_relaxed);
+		w.busyNanos.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(busy).count(),
+			std::memory_order_relaxed);
+		pixelsDone.fetch_add(pixels, std::memory_order_relaxed);
+		cameraRays.fetch_add(samples, std::memory_order_relaxed);
+		secondaryRays.fetch_add(secondary, std::memory_order_relaxed);
+		tilesDone.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void end()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = Timings::Clock::now();
+		finished.store(true);
+		setPhase(Phase::Writing);
+	}
+
+	void setPhase(Phase next) { phase.store(static_cast<int>(next)); }
+
+	int workerSlots() const { return workerCount; }
+	uint64_t cameraRayCount() const { return cameraRays.load(); }
+	uint64_t secondaryRayCount() const { return secondaryRays.load(); }
+
+	Snapshot snapshot() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		Snapshot s;
+		s.phase = static_cast<Phase>(phase.load());
+		s.done = finished.load();
+		s.elapsed = Timings::seconds(start, s.done ? stop : Timings::Clock::now());
+		s.tilesDone = tilesDone.load(std::memory_order_relaxed);
+		s.tileCount = tileCount;
+		s.pixelsDone = pixelsDone.load(std::memory_order_relaxed);
+		s.pixelCount = pixelCount;
+		s.cameraRays = cameraRays.load(std::memory_order_relaxed);
+		s.secondaryRays = secondaryRays.load(std::memory_order_relaxed);
+		s.peakResident = peakResidentBytes();
+		for (int i = 0; i < workerCount; i++)
+		{
+			s.workerTiles.push_back(static_cast<int>(workers[i].tiles.load(std::memory_order_relaxed)));
+			s.workerBusy.push_back(workers[i].busyNanos.load(std::memory_order_relaxed) * 1e-9);
+		}
+		return s;
+	}
+
+	static uint64_t peakResidentBytes()
+	{
+#ifndef _WIN32
+		rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+		return static_cast<uint64_t>(usage.ru_maxrss);
+#else
+		return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#else
+		return 0;
+#endif
+	}
+
+private:
+	static const size_t cacheLine = 64;
+
+	// A cache line each, so workers counting their own tiles do not contend
+	struct alignas(cacheLine) Worker
+	{
+		std::atomic<uint64_t> tiles;
+		std::atomic<uint64_t> busyNanos;
+	};
+
+	int tileCount = 0;
+	uint64_t pixelCount = 0;
+	std::unique_ptr<char[]> workerStorage;
+	Worker* workers = nullptr;
+	int workerCount = 0;
+	std::atomic<int> tilesDone{ 0 };
+	std::atomic<uint64_t> pixelsDone{ 0 };
+	std::atomic<uint64_t> cameraRays{ 0 };
+	std::atomic<uint64_t> secondaryRays{ 0 };
+	std::atomic<bool> finished{ false };
+	std::atomic<int> phase{ static_cast<int>(Phase::Setup) };
+	mutable std::mutex mutex;
+	Timings::Clock::time_point start = Timings::Clock::now();
+	Timings::Clock::time_point stop = start;
+
+	void allocateWorkers(int count)
+	{
+		// new only guarantees the default alignment before C++17, so the slots are placed on
+		// the first cache line boundary of a larger buffer
+		size_t bytes = count * sizeof(Worker);
+		size_t space = bytes + cacheLine;
+		workerStorage.reset(new char[space]);
+		void* first = workerStorage.get();
+		workers = static_cast<Worker*>(std::align(cacheLine, bytes, first, space));
+		for (int i = 0; i < count; i++)
+		{
+			Worker* worker = new (&workers[i]) Worker;
+			worker->tiles.store(0);
+			worker->busyNanos.store(0);
+		}
+		workerCount = count;
+	}
+};
+
+// Reports a render's metrics while it runs, from a thread of its own: a progress line on the
+// console, a stats file rewritten periodically, and an endpoint that answers each connection
+// with the current metrics as JSON. The camera shows the console line during the tiles; the
+// program owns the file and endpoint for the whole run, from scene load to the written
+// image. HTTP requests get an HTTP response, so curl and monitoring agents can poll it;
+// clients that send nothing get the bare JSON.
+class MetricsReporter
+{
+public:
+	struct Options
+	{
+		std::string file;					// Stats file, or empty for none
+		std::string endpoint;				// Socket endpoint (see Net), or empty for none
+		double interval = 1.0;				// Seconds between stats file rewrites
+		bool console = true;				// Show the progress line
+	};
+
+	MetricsReporter(const RenderMetrics& metrics, const Options& options)
+		: metrics(metrics), options(options)
+	{
+		std::string error;
+		if (!options.endpoint.empty() && !listener.open(options.endpoint, error))
+			std::cerr << "Metrics endpoint " << options.endpoint << " unavailable: " << error << "\n";
+
+		if (options.console || !options.file.empty() || listener.isOpen())
+			thread = std::thread(&MetricsReporter::run, this);
+	}
+
+	~MetricsReporter() { stop(); }
+
+	MetricsReporter(const MetricsReporter&) = delete;
+	MetricsReporter& operator=(const MetricsReporter&) = delete;
+
+	// Ends reporting, leaving the final metrics in the stats file
+	void stop()
+	{
+		if (!thread.joinable()) return;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		thread.join();
+
+		if (!options.file.empty())
+			writeFile(metrics.snapshot());
+	}
+
+private:
+	static const int tickMs = 250;
+
+	const RenderMetrics& metrics;
+	Options options;
+	Net::Listener listener;
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping = false;
+
+	void run()
+	{
+		auto lastWrite = Timings::Clock::now();
+		int lastRemaining = -1;
+
+		while (true)
+		{
+			// Serve requests while waiting for the next tick; a stop waits at most one tick
+			if (listener.isOpen())
+			{
+				auto client = listener.accept(tickMs);
+				if (client) serve(*client);
+			}
+
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				if (!listener.isOpen())
+					wake.wait_for(lock, std::chrono::milliseconds(tickMs), [this]() { return stopping; });
+				if (stopping) return;
+			}
+
+			RenderMetrics::Snapshot snapshot = metrics.snapshot();
+			int remaining = snapshot.tileCount - snapshot.tilesDone;
+			if (options.console && snapshot.tileCount > 0 && remaining != lastRemaining)
+			{
+				std::clog << "\rTiles remaining: " << remaining << " " << std::flush;
+				lastRemaining = remaining;
+			}
+
+			auto now = Timings::Clock::now();
+			if (!options.file.empty() && Timings::seconds(lastWrite, now) >= options.interval)
+			{
+				writeFile(snapshot);
+				lastWrite = now;
+			}
+		}
+	}
+
+	void serve(Net::Connection& client)
+	{
+		char request[1024];
+		client.setTimeout(0.2);
+		long size = client.receiveSome(request, sizeof(request));
+
+		std::string body = metrics.snapshot().json();
+		bool http = size >= 4 && (std::string(request, 4) == "GET " || std::string(request, 4) == "HEAD");
+		if (http)
+		{
+			client.send("HTTP/1.0 200 OK\r\nContent-Type: application/json\r\nContent-Length: "
+				+ std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n");
+			if (std::string(request, 4) == "HEAD") return;
+		}
+		client.send(body);
+	}
+
+	void writeFile(const RenderMetrics::Snapshot& snapshot) const
+	{
+		// Replace the file in one step, so readers never see a partial write
+		std::string temporary = options.file + ".tmp";
+		std::FILE* file = std::fopen(temporary.c_str(), "wb");
+		if (!file) return;
+		std::string body = snapshot.json();
+		bool ok = std::fwrite(body.data(), body.size(), 1, file) == 1;
+		ok = std::fclose(file) == 0 && ok;
+
+		if (ok && std::rename(temporary.c_str(), options.file.c_str()) != 0)
+		{
+			// Windows does not replace existing files on rename
+			std::remove(options.file.c_str());
+			ok = std::rename(temporary.c_str(), options.file.c_str()) == 0;
+		}
+		if (!ok) std::remove(temporary.c_str());
+	}
+};
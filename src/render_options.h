@@ -0,0 +1,307 @@
+#pragma once
+
+#include "camera.h"
+#include "scene_parser.h"
+
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ostream>
+#include <string>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+const char* const usage =
+	"Usage: Raytracer <scene> [output file] [options]\n"
+	"       Raytracer --serve <endpoint> [--scene-cache <n>]\n"
+	"       Raytracer --connect <endpoint> <scene> [output file] [options] | status | shutdown\n"
+	"       Raytracer --worker <endpoint> [--threads <n>]\n"
+	"  <scene>                  Scene file, or a number from 1 to 5 for a sample scene; scenes\n"
+	"                           are also looked for in $RTW_SCENES, in scenes/ of the working\n"
+	"                           directory or a parent, and in the source tree's scenes/\n"
+	"  -o, --output <file>      Output image (default output.png)\n"
+	"  --format <ext>           png, hdr, pfm or exr; replaces the output file's extension\n"
+	"  --threads <n>            Render threads (default one per hardware thread)\n"
+	"  --pin-threads            Pin render threads to CPUs; on NUMA machines each node also\n"
+	"                           gets a copy of the scene and its own band of the image\n"
+	"  --tile <pixels>          Tile size (default 16)\n"
+	"  --spp <n>                Samples per pixel\n"
+	"  --depth <n>              Maximum ray depth\n"
+	"  --resolution <w>[x<h>]   Image size; the scene's aspect ratio is kept without a height\n"
+	"  --bvh <builder>          median, sah or none (default median)\n"
+	"  --integrator <name>      path or normals (default path)\n"
+	"  --texture-cache <MB>     Memory cap for tiled texture files (default 256)\n"
+	"  --seed <n>               Random seed; a seed always renders the same image (default 0)\n"
+	"  --stream                 Write tiles to the output file as they finish\n"
+	"  --aov <names>            Also write AOV images, e.g. albedo,normal,depth or all\n"
+	"  --denoise                Filter the image guided by its AOVs\n"
+	"  --frames <n>             Render an animation of n frames, numbered in the output\n"
+	"                           file name, e.g. output.0001.png\n"
+	"  --fps <rate>             Frames per second of scene time (default 24)\n"
+	"  --metrics <file>         Rewrite progress and throughput metrics as JSON while rendering\n"
+	"  --metrics-interval <s>   Seconds between metrics file rewrites (default 1)\n"
+	"  --metrics-endpoint <at>  Serve the metrics over HTTP on a local port, host:port or\n"
+	"                           Unix socket path\n"
+	"  --trace <file>           Write a timeline of phases and tiles per thread, for\n"
+	"                           chrome://tracing or ui.perfetto.dev\n"
+	"  --distribute <endpoint>  Also render tiles in --worker processes connecting to a\n"
+	"                           port, host:port or Unix socket path\n"
+	"  --serve <endpoint>       Render requests from --connect on a port, host:port or Unix\n"
+	"                           socket path, keeping up to --scene-cache scenes (default 4)\n"
+	"                           loaded between them\n";
+
+// Settings from the command line that override each scene's camera. Numbers left at zero
+// keep the scene's values.
+struct RenderOptions
+{
+	std::string outputFile = "output.png";
+	std::string format;
+	int threads = 0;
+	int tileSize = 0;
+	int samplesPerPixel = 0;
+	int maxDepth = 0;
+	int width = 0;
+	int height = 0;
+	BVHBuilder bvh = BVHBuilder::Median;
+	Integrator integrator = Integrator::Path;
+	int textureCacheMB = 0;
+	uint32_t seed = 0;
+	bool pinThreads = false;
+	bool streamOutput = false;
+	unsigned aovs = 0;
+	bool denoise = false;
+	std::string traceFile;
+	std::string distributeEndpoint;
+	int frames = 0;
+	double fps = 24.0;
+	MetricsReporter::Options progress;
+
+	// Stats file and endpoint settings, for a reporter that lasts the whole run. The camera
+	// shows the console line itself while the tiles render.
+	MetricsReporter::Options reporting() const
+	{
+		MetricsReporter::Options options = progress;
+		options.console = false;
+		return options;
+	}
+
+	void apply(CameraSettings& camera) const
+	{
+		camera.outputFile = output();
+		camera.threadCount = threads;
+		camera.pinThreads = pinThreads;
+		if (tileSize > 0) camera.tileSize = tileSize;
+		if (samplesPerPixel > 0) camera.samplesPerPixel = samplesPerPixel;
+		if (maxDepth > 0) camera.maxDepth = maxDepth;
+		if (width > 0) camera.imageWidth = width;
+		if (height > 0) camera.fixedHeight = height;
+		camera.integrator = integrator;
+		camera.seed = seed;
+		camera.streamOutput = streamOutput;
+		camera.aovs = aovs;
+		camera.denoise = denoise;
+	}
+
+	std::string output() const
+	{
+		// The output format follows the file extension, which --format replaces
+		if (format.empty()) return outputFile;
+
+		size_t dot = outputFile.find_last_of('.');
+		size_t slash = outputFile.find_last_of("/\\");
+		bool hasExtension = dot != std::string::npos && (slash == std::string::npos || dot > slash);
+		return (hasExtension ? outputFile.substr(0, dot) : outputFile) + "." + format;
+	}
+
+	// Output of one animation frame: the frame number goes before the extension
+	std::string frameOutput(int frame) const
+	{
+		std::string file = output();
+		char number[16];
+		std::snprintf(number, sizeof(number), ".%04d", frame);
+
+		size_t dot = file.find_last_of('.');
+		size_t slash = file.find_last_of("/\\");
+		if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) return file + number;
+		return file.substr(0, dot) + number + file.substr(dot);
+	}
+};
+
+static bool parsePositive(const char* text, int& value)
+{
+	char* end;
+	long number = std::strtol(text, &end, 10);
+	if (end == text || *end != '\0' || number <= 0 || number > 1 << 30) return false;
+	value = static_cast<int>(number);
+	return true;
+}
+
+static bool parseResolution(const char* text, int& width, int& height)
+{
+	char* end;
+	long w = std::strtol(text, &end, 10);
+	if (end == text || w <= 0 || w > 1 << 20) return false;
+	width = static_cast<int>(w);
+	if (*end == '\0') return true;
+	return *end == 'x' && parsePositive(end + 1, height);
+}
+
+// Options that take no value, and the setting each turns on; every other option is
+// followed by one
+struct FlagOption
+{
+	const char* name;
+	bool RenderOptions::* setting;
+};
+
+static const FlagOption flagOptions[] = {
+	{ "--stream", &RenderOptions::streamOutput },
+	{ "--pin-threads", &RenderOptions::pinThreads },
+	{ "--denoise", &RenderOptions::denoise }
+};
+
+static const FlagOption* findFlagOption(const std::string& arg)
+{
+	for (const FlagOption& flag : flagOptions)
+	{
+		if (arg == flag.name) return &flag;
+	}
+	return nullptr;
+}
+
+static bool isFlagOption(const std::string& arg)
+{
+	return findFlagOption(arg) != nullptr;
+}
+
+// Parses the arguments after the scene, printing the problem on failure
+static bool parseOptions(int argc, char* argv[], RenderOptions& options, std::ostream& errors)
+{
+	for (int i = 2; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (const FlagOption* flag = findFlagOption(arg))
+		{
+			options.*flag->setting = true;
+			continue;
+		}
+		if (arg.compare(0, 1, "-") != 0)
+		{
+			options.outputFile = arg;
+			continue;
+		}
+
+		if (i + 1 >= argc)
+		{
+			errors << "Missing value for " << arg << ".\n";
+			return false;
+		}
+		const char* value = argv[++i];
+
+		bool ok = true;
+		if (arg == "-o" || arg == "--output") options.outputFile = value;
+		else if (arg == "--format")
+		{
+			options.format = value;
+			ok = options.format == "png" || options.format == "hdr"
+				|| options.format == "pfm" || options.format == "exr";
+		}
+		else if (arg == "--threads") ok = parsePositive(value, options.threads);
+		else if (arg == "--tile") ok = parsePositive(value, options.tileSize);
+		else if (arg == "--spp") ok = parsePositive(value, options.samplesPerPixel);
+		else if (arg == "--depth") ok = parsePositive(value, options.maxDepth);
+		else if (arg == "--resolution") ok = parseResolution(value, options.width, options.height);
+		else if (arg == "--texture-cache") ok = parsePositive(value, options.textureCacheMB);
+		else if (arg == "--seed")
+		{
+			char* end;
+			unsigned long number = std::strtoul(value, &end, 10);
+			ok = end != value && *end == '\0' && number <= 0xFFFFFFFFul;
+			options.seed = static_cast<uint32_t>(number);
+		}
+		else if (arg == "--aov") ok = parseAovs(value, options.aovs);
+		else if (arg == "--trace") options.traceFile = value;
+		else if (arg == "--distribute") options.distributeEndpoint = value;
+		else if (arg == "--frames") ok = parsePositive(value, options.frames);
+		else if (arg == "--fps")
+		{
+			char* end;
+			options.fps = std::strtod(value, &end);
+			ok = end != value && *end == '\0' && options.fps > 0.0;
+		}
+		else if (arg == "--metrics") options.progress.file = value;
+		else if (arg == "--metrics-endpoint") options.progress.endpoint = value;
+		else if (arg == "--metrics-interval")
+		{
+			char* end;
+			options.progress.interval = std::strtod(value, &end);
+			ok = end != value && *end == '\0' && options.progress.interval > 0.0;
+		}
+		else if (arg == "--bvh")
+		{
+			if (std::strcmp(value, "median") == 0) options.bvh = BVHBuilder::Median;
+			else if (std::strcmp(value, "sah") == 0) options.bvh = BVHBuilder::SAH;
+			else if (std::strcmp(value, "none") == 0) options.bvh = BVHBuilder::None;
+			else ok = false;
+		}
+		else if (arg == "--integrator")
+		{
+			if (std::strcmp(value, "path") == 0) options.integrator = Integrator::Path;
+			else if (std::strcmp(value, "normals") == 0) options.integrator = Integrator::Normals;
+			else ok = false;
+		}
+		else
+		{
+			errors << "Unknown option " << arg << ".\n" << usage;
+			return false;
+		}
+
+		if (!ok)
+		{
+			errors << "Invalid value '" << value << "' for " << arg << ".\n";
+			return false;
+		}
+	}
+	return true;
+}
+
+// A path made absolute against the working directory, and canonical if the file exists, so
+// that another process reading it finds the same file
+static std::string absolutePath(const std::string& path)
+{
+#ifdef _WIN32
+	char resolved[_MAX_PATH];
+	if (_fullpath(resolved, path.c_str(), sizeof(resolved))) return resolved;
+#else
+	char resolved[PATH_MAX];
+	if (realpath(path.c_str(), resolved)) return resolved;
+	if (!path.empty() && path[0] != '/' && getcwd(resolved, sizeof(resolved)))
+		return std::string(resolved) + "/" + path;
+#endif
+	return path;
+}
+
+// The scene argument: a scene file, or a number selecting one of the sample scenes
+static bool sceneArgument(const char* arg, std::string& scene, std::ostream& errors)
+{
+	char* numberEnd;
+	long sceneNumber = std::strtol(arg, &numberEnd, 10);
+	if (*numberEnd != '\0' || numberEnd == arg)
+	{
+		scene = arg;
+		return true;
+	}
+
+	const char* sample = SceneParser::sampleScene(sceneNumber);
+	if (!sample)
+	{
+		errors << "ERROR: There is no sample scene " << arg << "; they are numbered 1 to "
+			<< SceneParser::sampleSceneCount << ".\n";
+		return false;
+	}
+	scene = sample;
+	return true;
+}
@@ -0,0 +1,375 @@
+#pragma once
+
+#include "render_options.h"
+#include "scene_parser.h"
+#include "socket.h"
+#include "texture_cache.h"
+#include "timing.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Long running render service. A client connects to the socket endpoint, sends one request
+// line and gets one reply line, starting with "ok" or "error":
+//
+//   render <scene> [output file] [options]    Queues a render, replying once it is written
+//   status                                    Queued renders and resident scenes
+//   shutdown                                  Stops after the queued renders
+//
+// Options are those of the command line, except --frames and --distribute. The client sends
+// absolute scene and output paths, so they mean what they would in its own working
+// directory. Parsed scenes and their BVHs stay resident, keyed by the scene file's text and
+// the BVH builder, so renders that only change camera or sample settings skip parsing,
+// building and texture loading. Renders run one at a time, each on all render threads, in
+// the order they arrived.
+class RenderServer
+{
+public:
+	int cacheSize = 4;						// Scenes kept resident
+
+	// Serves until a shutdown request; returns false if the endpoint cannot be opened
+	bool run(const std::string& endpoint)
+	{
+		std::string error;
+		if (!listener.open(endpoint, error))
+		{
+			std::cerr << "Could not listen on " << endpoint << ": " << error << "\n";
+			return false;
+		}
+		std::clog << "Serving renders on " << endpoint << "\n";
+
+		std::thread acceptor(&RenderServer::acceptLoop, this);
+		while (true)
+		{
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				jobReady.wait(lock, [this]() { return stopping || !jobs.empty(); });
+				if (jobs.empty()) break;
+				job = std::move(jobs.front());
+				jobs.pop_front();
+				current = join(job.args);
+			}
+
+			std::string reply = render(job.args);
+			std::clog << reply << "\n";
+			job.client->send(reply + "\n");
+
+			std::lock_guard<std::mutex> lock(mutex);
+			current.clear();
+		}
+
+		acceptor.join();
+		listener.close();
+		return true;
+	}
+
+	// Sends one request and prints the reply, returning the process exit status
+	static int request(const std::string& endpoint, const std::vector<std::string>& args)
+	{
+		std::string error;
+		auto server = Net::connect(endpoint, error);
+		if (!server)
+		{
+			std::cerr << "Could not connect to " << endpoint << ": " << error << "\n";
+			return 1;
+		}
+
+		std::vector<std::string> words = args;
+		if (words[0] == "render") absolutePaths(words);
+
+		std::string reply;
+		if (!server->send(join(words) + "\n") || !readLine(*server, reply))
+		{
+			std::cerr << "No reply from " << endpoint << "\n";
+			return 1;
+		}
+		std::cout << reply << "\n";
+		return reply.compare(0, 2, "ok") == 0 ? 0 : 1;
+	}
+
+	// Request lines are words separated by spaces; words with spaces or quotes are quoted
+	static std::string join(const std::vector<std::string>& words)
+	{
+		std::string line;
+		for (const auto& word : words)
+		{
+			if (!line.empty()) line += ' ';
+			if (!word.empty() && word.find_first_of(" \t\"\\") == std::string::npos)
+			{
+				line += word;
+				continue;
+			}
+			line += '"';
+			for (char c : word)
+			{
+				if (c == '"' || c == '\\') line += '\\';
+				line += c;
+			}
+			line += '"';
+		}
+		return line;
+	}
+
+	static std::vector<std::string> split(const std::string& line)
+	{
+		std::vector<std::string> words;
+		size_t i = 0;
+		while (true)
+		{
+			while (i < line.size() && (line[i] == ' ' || line[i] == '\t' || line[i] == '\r'))
+				i++;
+			if (i >= line.size()) return words;
+
+			std::string word;
+			bool quoted = false;
+			for (; i < line.size() && (quoted || (line[i] != ' ' && line[i] != '\t' && line[i] != '\r')); i++)
+			{
+				if (line[i] == '"') quoted = !quoted;
+				else if (line[i] == '\\' && quoted && i + 1 < line.size()) word += line[++i];
+				else word += line[i];
+			}
+			words.push_back(word);
+		}
+	}
+
+private:
+	static const size_t maxRequest = 1 << 16;
+
+	struct Job
+	{
+		std::unique_ptr<Net::Connection> client;
+		std::vector<std::string> args;
+	};
+
+	struct CachedScene
+	{
+		uint64_t key;						// Hash of the text and builder, to find candidates fast
+		std::string text;
+		BVHBuilder builder;
+		std::string path;
+		std::shared_ptr<Scene> scene;
+	};
+
+	Net::Listener listener;
+	std::mutex mutex;						// Guards the queue, current and cache
+	std::condition_variable jobReady;
+	std::deque<Job> jobs;
+	std::string current;					// Request being rendered
+	bool stopping = false;
+	std::list<CachedScene> cache;			// Most recently used first
+
+	void acceptLoop()
+	{
+		while (true)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (stopping) return;
+			}
+
+			auto client = listener.accept(250);
+			if (!client) continue;
+
+			std::string line;
+			client->setTimeout(5.0);
+			if (!readLine(*client, line)) continue;
+			std::vector<std::string> args = split(line);
+
+			std::lock_guard<std::mutex> lock(mutex);
+			if (args.empty())
+				client->send("error empty request\n");
+			else if (args[0] == "status")
+				client->send(status() + "\n");
+			else if (args[0] == "shutdown")
+			{
+				stopping = true;
+				client->send("ok shutting down after " + std::to_string(jobs.size()) + " queued\n");
+				jobReady.notify_one();
+			}
+			else if (args[0] == "render")
+			{
+				client->setTimeout(0.0);
+				jobs.push_back(Job{ std::move(client), std::move(args) });
+				jobReady.notify_one();
+			}
+			else
+				client->send("error unknown request " + args[0] + "\n");
+		}
+	}
+
+	// Called with the mutex held
+	std::string status() const
+	{
+		std::string reply = "ok queued=" + std::to_string(jobs.size())
+			+ " rendering=" + (current.empty() ? "none" : "\"" + current + "\"") + " scenes=";
+		for (const auto& entry : cache)
+			reply += (&entry == &cache.front() ? "" : ",") + entry.path;
+		return reply;
+	}
+
+	std::string render(std::vector<std::string> args)
+	{
+		if (args.size() < 2) return "error render needs a scene";
+
+		std::vector<char*> argv;
+		for (auto& arg : args)
+			argv.push_back(&arg[0]);
+
+		std::ostringstream errors;
+		RenderOptions options;
+		if (!parseOptions(static_cast<int>(argv.size()), argv.data(), options, errors))
+			return "error " + firstLine(errors.str());
+
+		if (options.frames > 0) return "error --frames is not available from the server";
+		if (!options.distributeEndpoint.empty()) return "error --distribute is not available from the server";
+
+		if (options.textureCacheMB > 0)
+			TextureCache::instance().setCapacity(static_cast<size_t>(options.textureCacheMB) << 20);
+
+		auto start = Timings::Clock::now();
+		Timings::instance().reset();
+		if (!options.traceFile.empty())
+			Trace::instance().start();
+
+		// Metrics cover the whole request, so pollers see the scene load and the final state
+		RenderMetrics metrics;
+		MetricsReporter reporter(metrics, options.reporting());
+
+		bool cached;
+		std::string sceneFile;
+		std::shared_ptr<Scene> scene;
+		if (sceneArgument(argv[1], sceneFile, errors))
+			scene = load(sceneFile, options.bvh, cached, errors);
+		if (!scene)
+		{
+			metrics.setPhase(RenderMetrics::Phase::Done);
+			return "error " + firstLine(errors.str());
+		}
+		Timings::instance().add("Scene setup", Timings::instance().elapsed());
+
+		// The scene's camera keeps its file settings; each render overrides a copy
+		Camera camera;
+		static_cast<CameraSettings&>(camera) = scene->camera;
+		options.apply(camera);
+		camera.showProgress = false;
+		camera.reportTo(metrics);
+		camera.render(scene->world);
+
+		if (!options.traceFile.empty())
+			Trace::instance().write(options.traceFile);
+		metrics.setPhase(RenderMetrics::Phase::Done);
+		reporter.stop();
+
+		std::ostringstream reply;
+		reply.setf(std::ios::fixed);
+		reply.precision(3);
+		reply << "ok " << camera.outputFile << " cached=" << (cached ? "yes" : "no")
+			<< " setup=" << Timings::instance().get("Scene setup")
+			<< " render=" << Timings::instance().get("Render")
+			<< " total=" << Timings::seconds(start, Timings::Clock::now());
+		return reply.str();
+	}
+
+	std::shared_ptr<Scene> load(const std::string& filename, BVHBuilder builder, bool& cached, std::ostream& errors)
+	{
+		std::string path, text;
+		if (!SceneParser::read(filename, path, text, errors)) return nullptr;
+
+		uint64_t key = hash(text) ^ (static_cast<uint64_t>(builder) + 1) * 0x9E3779B97F4A7C15ull;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (auto entry = cache.begin(); entry != cache.end(); ++entry)
+			{
+				// The hash only narrows the search; a hit must be the same text
+				if (entry->key != key || entry->builder != builder || entry->text != text) continue;
+				cache.splice(cache.begin(), cache, entry);
+				cached = true;
+				return cache.front().scene;
+			}
+		}
+
+		auto scene = std::make_shared<Scene>();
+		if (!SceneParser::load(path, text, *scene, builder, errors)) return nullptr;
+		cached = false;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		cache.push_front(CachedScene{ key, text, builder, path, scene });
+		while (static_cast<int>(cache.size()) > cacheSize)
+			cache.pop_back();
+		return scene;
+	}
+
+	// FNV-1a
+	static uint64_t hash(const std::string& text)
+	{
+		uint64_t h = 0xcbf29ce484222325ull;
+		for (char c : text)
+		{
+			h ^= static_cast<unsigned char>(c);
+			h *= 0x100000001b3ull;
+		}
+		return h;
+	}
+
+	// Makes the scene, output, metrics and trace paths of a render request absolute, as found
+	// from the client's working directory. A scene not found here, such as a sample scene the
+	// client has no copy of, is left for the server to find.
+	static void absolutePaths(std::vector<std::string>& words)
+	{
+		std::string scene;
+		std::ostringstream errors;
+		if (words.size() >= 2 && sceneArgument(words[1].c_str(), scene, errors))
+		{
+			std::string path = SceneParser::resolve(scene);
+			if (!path.empty()) words[1] = absolutePath(path);
+		}
+
+		for (size_t i = 2; i < words.size(); i++)
+		{
+			const std::string& word = words[i];
+			if (word.compare(0, 1, "-") != 0)
+				words[i] = absolutePath(word);
+			else if (!isFlagOption(word) && i + 1 < words.size())
+			{
+				if (word == "-o" || word == "--output" || word == "--metrics" || word == "--trace")
+					words[i + 1] = absolutePath(words[i + 1]);
+				i++;
+			}
+		}
+	}
+
+	static std::string firstLine(const std::string& text)
+	{
+		return text.substr(0, text.find('\n'));
+	}
+
+	static bool readLine(Net::Connection& connection, std::string& line)
+	{
+		line.clear();
+		char buffer[4096];
+		while (line.size() < maxRequest)
+		{
+			long size = connection.receiveSome(buffer, sizeof(buffer));
+			if (size <= 0) return false;
+			line.append(buffer, static_cast<size_t>(size));
+
+			size_t newline = line.find('\n');
+			if (newline != std::string::npos)
+			{
+				line.resize(newline);
+				return true;
+			}
+		}
+		return false;
+	}
+};
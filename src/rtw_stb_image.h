@@ -14,8 +14,17 @@ STB Image helper code copied from Ray Tracing In One Weekend book
 #define STBI_FAILURE_USERMSG
 #include "stb_image.h"
 
+#include <sys/stat.h>
+
+#include <cstdio>
 #include <cstdlib>
 #include <iostream>
+#include <string>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
 
 class rtw_image
 {
@@ -31,23 +40,47 @@ public:
         // parent, on so on, for six levels up. If the image was not loaded successfully,
         // width() and height() will return 0.
 
-        auto filename = std::string(image_filename);
-        auto imagedir = getenv("RTW_IMAGES");
-
-        // Hunt for the image file in some likely locations.
-        if (imagedir && load(std::string(imagedir) + "/" + image_filename)) return;
-        if (load(filename)) return;
-        if (load("images/" + filename)) return;
-        if (load("../images/" + filename)) return;
-        if (load("../../images/" + filename)) return;
-        if (load("../../../images/" + filename)) return;
-        if (load("../../../../images/" + filename)) return;
-        if (load("../../../../../images/" + filename)) return;
-        if (load("../../../../../../images/" + filename)) return;
+        auto path = resolve(image_filename);
+        if (!path.empty() && load(path)) return;
 
         std::cerr << "ERROR: Could not load image file '" << image_filename << "'.\n";
     }
 
+    static std::string resolve(const char* image_filename)
+    {
+        // Returns the path of the first existing file among the likely locations described
+        // above, or an empty string if there is none. Only directories of the search path
+        // that exist are tried.
+
+        auto filename = std::string(image_filename);
+        for (const auto& dir : search_path())
+        {
+            if (exists(dir + filename)) return dir + filename;
+        }
+
+        return "";
+    }
+
+    static const std::vector<std::string>& search_path()
+    {
+        // The likely image directories, resolved once per process. Each entry is empty (the
+        // current directory) or ends with a slash.
+        static const std::vector<std::string> dirs = []() {
+            std::vector<std::string> found;
+            auto imagedir = getenv("RTW_IMAGES");
+            if (imagedir && is_directory(imagedir)) found.push_back(std::string(imagedir) + "/");
+
+            found.push_back("");
+            std::string up;
+            for (int level = 0; level < 7; level++, up += "../")
+            {
+                if (is_directory(up + "images")) found.push_back(up + "images/");
+            }
+            return found;
+        }();
+        return dirs;
+    }
+
     ~rtw_image()
     {
         delete[] bdata;
@@ -68,11 +101,15 @@ public:
 
         bytes_per_scanline = image_width * bytes_per_pixel;
         convert_to_bytes();
+
+        // Only the byte data is sampled, so the float buffer is released right away
+        STBI_FREE(fdata);
+        fdata = nullptr;
         return true;
     }
 
-    int width()  const { return (fdata == nullptr) ? 0 : image_width; }
-    int height() const { return (fdata == nullptr) ? 0 : image_height; }
+    int width()  const { return (bdata == nullptr) ? 0 : image_width; }
+    int height() const { return (bdata == nullptr) ? 0 : image_height; }
 
     const unsigned char* pixel_data(int x, int y) const
     {
@@ -95,6 +132,20 @@ private:
     int            image_height = 0;        // Loaded image height
     int            bytes_per_scanline = 0;
 
+    static bool exists(const std::string& filename)
+    {
+        std::FILE* file = std::fopen(filename.c_str(), "rb");
+        if (!file) return false;
+        std::fclose(file);
+        return true;
+    }
+
+    static bool is_directory(const std::string& path)
+    {
+        struct stat info;
+        return stat(path.c_str(), &info) == 0 && (info.st_mode & S_IFMT) == S_IFDIR;
+    }
+
     static int clamp(int x, int low, int high)
     {
         // Return the value clamped to the range [low, high).
@@ -125,7 +176,30 @@ private:
 
         auto* bptr = bdata;
         auto* fptr = fdata;
-        for (auto i = 0; i < total_bytes; i++, fptr++, bptr++)
+        auto i = 0;
+
+#if defined(__SSE2__) || defined(_M_X64)
+        // Sixteen components at a time: scale, clamp to [0, 255], truncate and pack, which
+        // matches float_to_byte for all finite inputs
+        const __m128 scale = _mm_set1_ps(256.0f);
+        const __m128 low = _mm_setzero_ps();
+        const __m128 high = _mm_set1_ps(255.0f);
+        for (; i + 16 <= total_bytes; i += 16, fptr += 16, bptr += 16)
+        {
+            __m128i q[4];
+            for (int k = 0; k < 4; k++)
+            {
+                __m128 v = _mm_mul_ps(_mm_loadu_ps(fptr + 4 * k), scale);
+                v = _mm_min_ps(_mm_max_ps(v, low), high);
+                q[k] = _mm_cvttps_epi32(v);
+            }
+            __m128i lo = _mm_packs_epi32(q[0], q[1]);
+            __m128i hi = _mm_packs_epi32(q[2], q[3]);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(bptr), _mm_packus_epi16(lo, hi));
+        }
+#endif
+
+        for (; i < total_bytes; i++, fptr++, bptr++)
             *bptr = float_to_byte(*fptr);
     }
 };
@@ -0,0 +1,577 @@
+#pragma once
+
+#include "bvh.h"
+#include "camera.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "quad.h"
+#include "sphere.h"
+#include "sphere_group.h"
+#include "texture.h"
+#include "timing.h"
+
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Scene description files. Each line is one statement: a keyword followed by its
+// arguments, separated by whitespace; '#' starts a comment. Vectors and colors are three
+// numbers. Names must be defined before they are used.
+//
+//   camera <setting> <values> [<setting> <values>...]
+//       aspect <w> <h>, width <pixels>, spp <n>, depth <n>, background <color>,
+//       vfov <degrees>, from <point>, at <point>, up <vec>, defocus <degrees>, focus <dist>
+//   texture <name> solid <color>
+//   texture <name> checker <scale> <even> <odd>
+//   texture <name> image <file>
+//   material <name> lambertian <albedo>
+//   material <name> metal <color> <fuzz>
+//   material <name> dielectric <refraction index>
+//   material <name> light <emission>
+//   sphere <material> <center> <radius> [moving <center at time 1>] [path <keys>]
+//   quad <material> <corner> <u> <v>
+//   box <material> <corner> <opposite corner>
+//   object <name> ... end             Defines a group that is only drawn through instances
+//   instance <name> [rotatey <degrees>] [translate <vec>]...
+//       rotatey path <keys> and translate path <keys> animate a transform
+//   packed ... end                    Spheres packed into SIMD sphere groups
+//
+// Image files are looked for next to the scene file and in an images directory beside it or
+// one of its parents, then where rtw_image looks from the working directory, so a scene given
+// by absolute path finds the same images from any directory. RTW_IMAGES, when set, overrides
+// the scene's directories as it does the working directory's.
+//
+// Where a texture is expected (checker children, albedo, emission) either a texture name
+// or a color may be given. Where a material is expected, a material name or an unnamed
+// material definition such as "metal 0.7 0.6 0.5 0.0" may be given. The parser makes one
+// pass over the file, then load() builds a BVH over the top level objects.
+//
+// Animation keys are a time in seconds followed by the value at that time, repeated in
+// increasing time order; values are interpolated linearly between keys. "moving" is motion
+// within the shutter of one frame, and a path moves that shutter interval's start.
+
+struct Scene
+{
+	Camera camera;
+	HittableList world;
+	std::vector<std::shared_ptr<Hittable>> objects;		// Top level objects, for BVH rebuilds
+	std::shared_ptr<HittableRegistry> registry;			// Ids of the scene's primitives, from 0
+};
+
+class SceneParser
+{
+public:
+	// Loads a scene, printing an error with the file and line on failure
+	static bool load(const std::string& filename, Scene& scene, BVHBuilder builder = BVHBuilder::Median)
+	{
+		std::string path, text;
+		if (!read(filename, path, text, std::cerr)) return false;
+		return load(path, text, scene, builder, std::cerr);
+	}
+
+	// Reads a scene file found as resolve() finds it
+	static bool read(const std::string& filename, std::string& path, std::string& text, std::ostream& errors)
+	{
+		path = resolve(filename);
+		if (path.empty() || !readFile(path, text))
+		{
+			errors << "ERROR: Could not open scene file '" << filename << "'.\n";
+			return false;
+		}
+		return true;
+	}
+
+	// Loads a scene from the text of the file at path
+	static bool load(
+		const std::string& path, const std::string& text, Scene& scene, BVHBuilder builder,
+		std::ostream& errors
+	)
+	{
+		// Objects of this scene register with its own registry, which goes with the scene
+		scene.registry = std::make_shared<HittableRegistry>();
+		HittableRegistry::Scope registryScope(scene.registry);
+		scene.world = HittableList();
+
+		{
+			ScopedTimer timer("Scene parse");
+			SceneParser parser(text);
+			size_t slash = path.find_last_of("/\\");
+			if (slash != std::string::npos) parser.directory = path.substr(0, slash + 1);
+			try
+			{
+				parser.parse(scene);
+			}
+			catch (const std::runtime_error& e)
+			{
+				errors << path << ":" << parser.line << ": " << e.what() << "\n";
+				return false;
+			}
+		}
+
+		// Pose animated objects at the start, before bounds are taken for the BVH
+		scene.world.update(0.0f);
+		scene.objects = scene.world.objects;
+
+		if (builder != BVHBuilder::None && scene.world.objects.size() > 1)
+		{
+			ScopedTimer timer("BVH build");
+			scene.world = HittableList(std::make_shared<BVHNode>(scene.world, builder));
+		}
+		return true;
+	}
+
+	// File name of a sample scene in the scenes directory, numbered from 1, or null for a
+	// number out of range
+	static const char* sampleScene(long number)
+	{
+		static const char* files[] = {
+			"bouncing_spheres.scene",
+			"checkered_spheres.scene",
+			"earth.scene",
+			"quads.scene",
+			"cornell_box.scene"
+		};
+		return number >= 1 && number <= sampleSceneCount ? files[number - 1] : nullptr;
+	}
+
+	static const int sampleSceneCount = 5;
+
+	// Finds a scene file as given, in the RTW_SCENES directory when that is set, in a scenes
+	// directory of the working directory or one of its parents, and finally in the source
+	// tree's scenes directory the build recorded. The .scene extension may be left out.
+	static std::string resolve(const std::string& filename)
+	{
+		std::string names[] = { filename, filename + ".scene" };
+		for (const auto& name : names)
+		{
+			if (exists(name)) return name;
+		}
+
+		std::vector<std::string> dirs;
+		if (const char* sceneDir = std::getenv("RTW_SCENES")) dirs.push_back(std::string(sceneDir) + "/");
+		std::string up;
+		for (int level = 0; level < 7; level++, up += "../")
+			dirs.push_back(up + "scenes/");
+#ifdef RAYTRACER_SCENE_DIR
+		dirs.push_back(RAYTRACER_SCENE_DIR "/");
+#endif
+
+		for (const auto& dir : dirs)
+		{
+			for (const auto& name : names)
+			{
+				if (exists(dir + name)) return dir + name;
+			}
+		}
+		return "";
+	}
+
+private:
+	// Open object or packed block
+	struct Block
+	{
+		std::string keyword;
+		std::string name;
+		std::shared_ptr<HittableList> objects;
+		std::vector<SphereDesc> spheres;
+	};
+
+	const char* cursor;
+	const char* end;
+	std::string directory;				// Of the scene file, ending with a slash, or empty
+	int line = 0;
+	uint32_t materialCount = 0;
+
+	std::unordered_map<std::string, std::shared_ptr<Texture>> textures;
+	std::unordered_map<std::string, std::shared_ptr<Material>> materials;
+	std::unordered_map<std::string, std::shared_ptr<Hittable>> objects;
+	std::vector<Block> blocks;
+
+	SceneParser(const std::string& text) : cursor(text.data()), end(text.data() + text.size()) {}
+
+	static bool exists(const std::string& path)
+	{
+		std::FILE* file = std::fopen(path.c_str(), "rb");
+		if (!file) return false;
+		std::fclose(file);
+		return true;
+	}
+
+	std::string imageFile(const std::string& name) const
+	{
+		if (name.empty() || name[0] == '/' || name[0] == '\\' || std::getenv("RTW_IMAGES")) return name;
+
+		std::string up;
+		for (int level = 0; level < 7; level++, up += "../")
+		{
+			if (level == 0 && exists(directory + name)) return directory + name;
+			if (exists(directory + up + "images/" + name)) return directory + up + "images/" + name;
+		}
+		return name;
+	}
+
+	static bool readFile(const std::string& path, std::string& text)
+	{
+		std::FILE* file = std::fopen(path.c_str(), "rb");
+		if (!file) return false;
+
+		char buffer[1 << 16];
+		size_t count;
+		while ((count = std::fread(buffer, 1, sizeof(buffer), file)) > 0)
+			text.append(buffer, count);
+		std::fclose(file);
+		return true;
+	}
+
+	static void fail(const std::string& message)
+	{
+		throw std::runtime_error(message);
+	}
+
+	// Tokenizer
+
+	bool nextLine()
+	{
+		// Moves to the start of the next line with a statement
+		while (cursor < end)
+		{
+			line++;
+			skipSpace();
+			if (cursor < end && *cursor != '\n') return true;
+			if (cursor < end) cursor++;
+		}
+		return false;
+	}
+
+	void skipSpace()
+	{
+		while (cursor < end && (*cursor == ' ' || *cursor == '\t' || *cursor == '\r'))
+			cursor++;
+		if (cursor < end && *cursor == '#')
+		{
+			while (cursor < end && *cursor != '\n')
+				cursor++;
+		}
+	}
+
+	bool atLineEnd()
+	{
+		skipSpace();
+		return cursor >= end || *cursor == '\n';
+	}
+
+	void endLine()
+	{
+		if (!atLineEnd()) fail("unexpected '" + word() + "'");
+		if (cursor < end) cursor++;
+	}
+
+	std::string word()
+	{
+		if (atLineEnd()) fail("unexpected end of line");
+		const char* start = cursor;
+		while (cursor < end && !std::isspace(static_cast<unsigned char>(*cursor)) && *cursor != '#')
+			cursor++;
+		return std::string(start, cursor);
+	}
+
+	bool nextIsPath()
+	{
+		// Consumes a "path" word if it is next
+		if (nextIsNumber() || atLineEnd() || std::strncmp(cursor, "path", 4) != 0) return false;
+		const char* after = cursor + 4;
+		if (after < end && !std::isspace(static_cast<unsigned char>(*after)) && *after != '#') return false;
+		cursor = after;
+		return true;
+	}
+
+	bool nextIsNumber()
+	{
+		if (atLineEnd()) return false;
+		char c = *cursor;
+		return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.';
+	}
+
+	float number()
+	{
+		if (!nextIsNumber()) fail(atLineEnd() ? "expected a number" : "expected a number, not '" + word() + "'");
+		char* numberEnd;
+		float value = std::strtof(cursor, &numberEnd);
+		if (numberEnd == cursor) fail("expected a number");
+		cursor = numberEnd;
+		return value;
+	}
+
+	int integer()
+	{
+		float value = number();
+		if (value != std::floor(value)) fail("expected an integer");
+		return static_cast<int>(value);
+	}
+
+	Vec3 vec3()
+	{
+		float x = number();
+		float y = number();
+		float z = number();
+		return Vec3(x, y, z);
+	}
+
+	template <typename T, typename ReadValue>
+	Track<T> keys(ReadValue readValue)
+	{
+		Track<T> track;
+		float last = -infinity;
+		do
+		{
+			float time = number();
+			if (time <= last) fail("key times must increase");
+			track.add(time, readValue());
+			last = time;
+		} while (nextIsNumber());
+		return track;
+	}
+
+	Track<Vec3> vec3Keys() { return keys<Vec3>([this]() { return vec3(); }); }
+	Track<float> numberKeys() { return keys<float>([this]() { return number(); }); }
+
+	// Statements
+
+	void parse(Scene& scene)
+	{
+		while (nextLine())
+		{
+			std::string keyword = word();
+			if (keyword == "camera") parseCamera(scene.camera);
+			else if (keyword == "texture") parseTexture();
+			else if (keyword == "material") parseMaterial();
+			else if (keyword == "sphere") parseSphere(scene);
+			else if (keyword == "quad") parseQuad(scene);
+			else if (keyword == "box") parseBox(scene);
+			else if (keyword == "instance") parseInstance(scene);
+			else if (keyword == "object" || keyword == "packed") openBlock(keyword);
+			else if (keyword == "end") closeBlock(scene);
+			else fail("unknown statement '" + keyword + "'");
+			endLine();
+		}
+
+		if (!blocks.empty()) fail("missing 'end' for '" + blocks.back().keyword + "'");
+	}
+
+	void parseCamera(Camera& camera)
+	{
+		while (!atLineEnd())
+		{
+			std::string setting = word();
+			if (setting == "aspect")
+			{
+				float w = number();
+				camera.aspectRatio = w / number();
+			}
+			else if (setting == "width") camera.imageWidth = integer();
+			else if (setting == "spp") camera.samplesPerPixel = integer();
+			else if (setting == "depth") camera.maxDepth = integer();
+			else if (setting == "background") camera.background = vec3();
+			else if (setting == "vfov") camera.vFov = number();
+			else if (setting == "from") camera.lookFrom = vec3();
+			else if (setting == "at") camera.lookAt = vec3();
+			else if (setting == "up") camera.viewUp = vec3();
+			else if (setting == "defocus") camera.defocusAngle = number();
+			else if (setting == "focus") camera.focusDist = number();
+			else fail("unknown camera setting '" + setting + "'");
+		}
+	}
+
+	void parseTexture()
+	{
+		std::string name = word();
+		std::string type = word();
+
+		std::shared_ptr<Texture> texture;
+		if (type == "solid") texture = std::make_shared<SolidColor>(vec3());
+		else if (type == "checker")
+		{
+			float scale = number();
+			auto even = textureArgument();
+			texture = std::make_shared<CheckerTexture>(scale, even, textureArgument());
+		}
+		else if (type == "image") texture = std::make_shared<ImageTexture>(imageFile(word()).c_str());
+		else fail("unknown texture type '" + type + "'");
+
+		textures[name] = texture;
+	}
+
+	std::shared_ptr<Texture> textureArgument()
+	{
+		if (nextIsNumber()) return std::make_shared<SolidColor>(vec3());
+
+		std::string name = word();
+		auto found = textures.find(name);
+		if (found == textures.end()) fail("unknown texture '" + name + "'");
+		return found->second;
+	}
+
+	void parseMaterial()
+	{
+		std::string name = word();
+		materials[name] = materialDefinition(word());
+	}
+
+	std::shared_ptr<Material> materialDefinition(const std::string& type)
+	{
+		if (type == "lambertian") return numbered(std::make_shared<Lambertian>(textureArgument()));
+		if (type == "metal")
+		{
+			Color albedo = vec3();
+			return numbered(std::make_shared<Metal>(albedo, number()));
+		}
+		if (type == "dielectric") return numbered(std::make_shared<Dielectric>(number()));
+		if (type == "light") return numbered(std::make_shared<DiffuseLight>(textureArgument()));
+
+		fail("unknown material type '" + type + "'");
+		return nullptr;
+	}
+
+	// Material ids count from 0 in each scene, in the order the file defines them
+	std::shared_ptr<Material> numbered(std::shared_ptr<Material> material)
+	{
+		material->setId(materialCount++);
+		return material;
+	}
+
+	std::shared_ptr<Material> materialArgument()
+	{
+		std::string name = word();
+		auto found = materials.find(name);
+		if (found != materials.end()) return found->second;
+
+		if (name == "lambertian" || name == "metal" || name == "dielectric" || name == "light")
+			return materialDefinition(name);
+
+		fail("unknown material '" + name + "'");
+		return nullptr;
+	}
+
+	void add(Scene& scene, std::shared_ptr<Hittable> object)
+	{
+		// Adds to the innermost open object, or the scene itself
+		if (!blocks.empty() && blocks.back().keyword == "packed")
+			fail("only spheres can be packed");
+
+		if (blocks.empty())
+			scene.world.add(object);
+		else
+			blocks.back().objects->add(object);
+	}
+
+	void parseSphere(Scene& scene)
+	{
+		auto mat = materialArgument();
+		Point3 center = vec3();
+		float radius = number();
+		Point3 center2 = center;
+		bool moving = false;
+		Track<Point3> path;
+		while (!atLineEnd())
+		{
+			std::string option = word();
+			if (option == "moving" && !moving)
+			{
+				center2 = vec3();
+				moving = true;
+			}
+			else if (option == "path" && path.empty()) path = vec3Keys();
+			else fail("unexpected '" + option + "'");
+		}
+
+		bool packed = !blocks.empty() && blocks.back().keyword == "packed";
+		if (packed && !path.empty()) fail("packed spheres can not follow a path");
+
+		if (packed)
+			blocks.back().spheres.push_back(SphereDesc{ center, center2, radius, mat });
+		else
+		{
+			auto sphere = moving ? std::make_shared<Sphere>(center, center2, radius, mat)
+				: std::make_shared<Sphere>(center, radius, mat);
+			if (!path.empty()) sphere->setPath(path);
+			add(scene, sphere);
+		}
+	}
+
+	void parseQuad(Scene& scene)
+	{
+		auto mat = materialArgument();
+		Point3 q = vec3();
+		Vec3 u = vec3();
+		add(scene, std::make_shared<Quad>(q, u, vec3(), mat));
+	}
+
+	void parseBox(Scene& scene)
+	{
+		auto mat = materialArgument();
+		Point3 a = vec3();
+		add(scene, box(a, vec3(), mat));
+	}
+
+	void parseInstance(Scene& scene)
+	{
+		std::string name = word();
+		auto found = objects.find(name);
+		if (found == objects.end()) fail("unknown object '" + name + "'");
+
+		// Transforms apply in the order they are listed
+		std::shared_ptr<Hittable> instance = found->second;
+		while (!atLineEnd())
+		{
+			std::string transform = word();
+			if (transform == "rotatey")
+			{
+				if (nextIsPath()) instance = std::make_shared<RotateY>(instance, numberKeys());
+				else instance = std::make_shared<RotateY>(instance, number());
+			}
+			else if (transform == "translate")
+			{
+				if (nextIsPath()) instance = std::make_shared<Translate>(instance, vec3Keys());
+				else instance = std::make_shared<Translate>(instance, vec3());
+			}
+			else fail("unknown transform '" + transform + "'");
+		}
+		add(scene, instance);
+	}
+
+	void openBlock(const std::string& keyword)
+	{
+		Block block;
+		block.keyword = keyword;
+		block.objects = std::make_shared<HittableList>();
+		if (keyword == "object") block.name = word();
+		blocks.push_back(block);
+	}
+
+	void closeBlock(Scene& scene)
+	{
+		if (blocks.empty()) fail("'end' without 'object' or 'packed'");
+
+		Block block = blocks.back();
+		blocks.pop_back();
+
+		if (block.keyword == "packed")
+		{
+			HittableList groups;
+			packSpheres(block.spheres, groups);
+			for (const auto& group : groups.objects)
+				add(scene, group);
+		}
+		else
+		{
+			objects[block.name] = block.objects;
+		}
+	}
+};
@@ -0,0 +1,103 @@
+#pragma once
+
+// Thin wrapper over the widest float vector the compiler targets: 8 lanes with AVX,
+// 4 lanes with SSE2 (always available on x86-64) and a single scalar lane otherwise.
+// Comparisons return masks in the same type, which are consumed by select() and mask().
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define RT_SIMD_WIDTH 8
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RT_SIMD_WIDTH 4
+#else
+#include <cmath>
+#include <cstring>
+#define RT_SIMD_WIDTH 1
+#endif
+
+struct SimdFloat
+{
+	static const int width = RT_SIMD_WIDTH;
+
+#if RT_SIMD_WIDTH == 8
+	__m256 v;
+
+	SimdFloat() {}
+	SimdFloat(__m256 v) : v(v) {}
+	SimdFloat(float a) : v(_mm256_set1_ps(a)) {}
+
+	static SimdFloat load(const float* p) { return _mm256_loadu_ps(p); }
+	void store(float* p) const { _mm256_storeu_ps(p, v); }
+
+	friend SimdFloat operator+(SimdFloat a, SimdFloat b) { return _mm256_add_ps(a.v, b.v); }
+	friend SimdFloat operator-(SimdFloat a, SimdFloat b) { return _mm256_sub_ps(a.v, b.v); }
+	friend SimdFloat operator*(SimdFloat a, SimdFloat b) { return _mm256_mul_ps(a.v, b.v); }
+	friend SimdFloat operator<(SimdFloat a, SimdFloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+	friend SimdFloat operator>(SimdFloat a, SimdFloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+	friend SimdFloat operator>=(SimdFloat a, SimdFloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ); }
+	friend SimdFloat operator&(SimdFloat a, SimdFloat b) { return _mm256_and_ps(a.v, b.v); }
+	friend SimdFloat operator|(SimdFloat a, SimdFloat b) { return _mm256_or_ps(a.v, b.v); }
+
+	friend SimdFloat sqrt(SimdFloat a) { return _mm256_sqrt_ps(a.v); }
+	friend SimdFloat max(SimdFloat a, SimdFloat b) { return _mm256_max_ps(a.v, b.v); }
+	friend SimdFloat min(SimdFloat a, SimdFloat b) { return _mm256_min_ps(a.v, b.v); }
+	friend SimdFloat select(SimdFloat mask, SimdFloat a, SimdFloat b) { return _mm256_blendv_ps(b.v, a.v, mask.v); }
+	friend int mask(SimdFloat a) { return _mm256_movemask_ps(a.v); }
+
+#elif RT_SIMD_WIDTH == 4
+	__m128 v;
+
+	SimdFloat() {}
+	SimdFloat(__m128 v) : v(v) {}
+	SimdFloat(float a) : v(_mm_set1_ps(a)) {}
+
+	static SimdFloat load(const float* p) { return _mm_loadu_ps(p); }
+	void store(float* p) const { _mm_storeu_ps(p, v); }
+
+	friend SimdFloat operator+(SimdFloat a, SimdFloat b) { return _mm_add_ps(a.v, b.v); }
+	friend SimdFloat operator-(SimdFloat a, SimdFloat b) { return _mm_sub_ps(a.v, b.v); }
+	friend SimdFloat operator*(SimdFloat a, SimdFloat b) { return _mm_mul_ps(a.v, b.v); }
+	friend SimdFloat operator<(SimdFloat a, SimdFloat b) { return _mm_cmplt_ps(a.v, b.v); }
+	friend SimdFloat operator>(SimdFloat a, SimdFloat b) { return _mm_cmpgt_ps(a.v, b.v); }
+	friend SimdFloat operator>=(SimdFloat a, SimdFloat b) { return _mm_cmpge_ps(a.v, b.v); }
+	friend SimdFloat operator&(SimdFloat a, SimdFloat b) { return _mm_and_ps(a.v, b.v); }
+	friend SimdFloat operator|(SimdFloat a, SimdFloat b) { return _mm_or_ps(a.v, b.v); }
+
+	friend SimdFloat sqrt(SimdFloat a) { return _mm_sqrt_ps(a.v); }
+	friend SimdFloat max(SimdFloat a, SimdFloat b) { return _mm_max_ps(a.v, b.v); }
+	friend SimdFloat min(SimdFloat a, SimdFloat b) { return _mm_min_ps(a.v, b.v); }
+	friend SimdFloat select(SimdFloat mask, SimdFloat a, SimdFloat b)
+	{
+		return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v));
+	}
+	friend int mask(SimdFloat a) { return _mm_movemask_ps(a.v); }
+
+#else
+	float v;
+
+	SimdFloat() {}
+	SimdFloat(float a) : v(a) {}
+
+	static SimdFloat load(const float* p) { return *p; }
+	void store(float* p) const { *p = v; }
+
+	friend SimdFloat operator+(SimdFloat a, SimdFloat b) { return a.v + b.v; }
+	friend SimdFloat operator-(SimdFloat a, SimdFloat b) { return a.v - b.v; }
+	friend SimdFloat operator*(SimdFloat a, SimdFloat b) { return a.v * b.v; }
+	friend SimdFloat operator<(SimdFloat a, SimdFloat b) { return fromBool(a.v < b.v); }
+	friend SimdFloat operator>(SimdFloat a, SimdFloat b) { return fromBool(a.v > b.v); }
+	friend SimdFloat operator>=(SimdFloat a, SimdFloat b) { return fromBool(a.v >= b.v); }
+	friend SimdFloat operator&(SimdFloat a, SimdFloat b) { return fromBool(mask(a) && mask(b)); }
+	friend SimdFloat operator|(SimdFloat a, SimdFloat b) { return fromBool(mask(a) || mask(b)); }
+
+	friend SimdFloat sqrt(SimdFloat a) { return std::sqrt(a.v); }
+	friend SimdFloat max(SimdFloat a, SimdFloat b) { return a.v > b.v ? a.v : b.v; }
+	friend SimdFloat min(SimdFloat a, SimdFloat b) { return a.v < b.v ? a.v : b.v; }
+	friend SimdFloat select(SimdFloat mask, SimdFloat a, SimdFloat b) { return mask.v != 0.0f ? a : b; }
+	friend int mask(SimdFloat a) { return a.v != 0.0f; }
+
+private:
+	static SimdFloat fromBool(bool b) { return b ? 1.0f : 0.0f; }
+#endif
+};
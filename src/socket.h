@@ -0,0 +1,315 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#ifndef _WIN32
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// Stream sockets for the local services. An endpoint is a TCP port on the loopback
+// interface ("8080"), a host and port ("render01:8080", or "*:8080" to listen on every
+// interface), or otherwise the path of a Unix domain socket. Not available on Windows,
+// where opening an endpoint fails.
+namespace Net
+{
+#ifndef _WIN32
+	// Splits "port" or "host:port"; anything else is a Unix socket path
+	inline bool splitEndpoint(const std::string& endpoint, std::string& host, std::string& port)
+	{
+		size_t colon = endpoint.find_last_of(':');
+		port = colon == std::string::npos ? endpoint : endpoint.substr(colon + 1);
+		host = colon == std::string::npos ? "127.0.0.1" : endpoint.substr(0, colon);
+		if (port.empty() || port.size() > 5 || host.find('/') != std::string::npos) return false;
+		for (char c : port)
+		{
+			if (c < '0' || c > '9') return false;
+		}
+		return true;
+	}
+
+	inline addrinfo* resolve(const std::string& host, const std::string& port, bool passive, std::string& error)
+	{
+		addrinfo hints = {};
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		if (passive) hints.ai_flags = AI_PASSIVE;
+
+		addrinfo* addresses = nullptr;
+		int rc = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &addresses);
+		if (rc != 0)
+		{
+			error = gai_strerror(rc);
+			return nullptr;
+		}
+		return addresses;
+	}
+
+	// A peer that disconnects mid-reply must fail the send, not kill the process
+	inline void ignoreBrokenPipes()
+	{
+		signal(SIGPIPE, SIG_IGN);
+	}
+#endif
+
+	class Connection
+	{
+	public:
+		explicit Connection(int fd) : fd(fd) {}
+		~Connection() { close(); }
+
+		Connection(const Connection&) = delete;
+		Connection& operator=(const Connection&) = delete;
+
+		bool send(const void* data, size_t size)
+		{
+#ifndef _WIN32
+			auto bytes = static_cast<const char*>(data);
+			while (size > 0)
+			{
+				ssize_t sent = ::send(fd, bytes, size, 0);
+				if (sent <= 0) return false;
+				bytes += sent;
+				size -= static_cast<size_t>(sent);
+			}
+			return true;
+#else
+			return false;
+#endif
+		}
+
+		bool send(const std::string& text) { return send(text.data(), text.size()); }
+
+		// Reads exactly size bytes, failing on a closed connection or timeout
+		bool receive(void* data, size_t size)
+		{
+#ifndef _WIN32
+			auto bytes = static_cast<char*>(data);
+			while (size > 0)
+			{
+				ssize_t received = ::recv(fd, bytes, size, 0);
+				if (received <= 0) return false;
+				bytes += received;
+				size -= static_cast<size_t>(received);
+			}
+			return true;
+#else
+			return false;
+#endif
+		}
+
+		// Reads whatever has arrived, up to size bytes; returns 0 once the peer closed
+		long receiveSome(void* data, size_t size)
+		{
+#ifndef _WIN32
+			return static_cast<long>(::recv(fd, data, size, 0));
+#else
+			return -1;
+#endif
+		}
+
+		// Fails blocking reads that wait longer than this, or never for 0
+		void setTimeout(double seconds)
+		{
+#ifndef _WIN32
+			timeval timeout;
+			timeout.tv_sec = static_cast<long>(seconds);
+			timeout.tv_usec = static_cast<long>((seconds - timeout.tv_sec) * 1e6);
+			setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+#endif
+		}
+
+		// Ends both directions, failing reads blocked in another thread; the socket stays open
+		void shutdown()
+		{
+#ifndef _WIN32
+			if (fd >= 0) ::shutdown(fd, SHUT_RDWR);
+#endif
+		}
+
+		void close()
+		{
+#ifndef _WIN32
+			if (fd >= 0) ::close(fd);
+#endif
+			fd = -1;
+		}
+
+	private:
+		int fd;
+	};
+
+	class Listener
+	{
+	public:
+		Listener() {}
+		~Listener() { close(); }
+
+		Listener(const Listener&) = delete;
+		Listener& operator=(const Listener&) = delete;
+
+		bool open(const std::string& endpoint, std::string& error)
+		{
+			close();
+#ifndef _WIN32
+			std::string host, port;
+			if (!splitEndpoint(endpoint, host, port))
+			{
+				if (endpoint.size() >= sizeof(sockaddr_un::sun_path))
+				{
+					error = "socket path too long";
+					return false;
+				}
+				sockaddr_un address = {};
+				address.sun_family = AF_UNIX;
+				std::strcpy(address.sun_path, endpoint.c_str());
+
+				// A socket file left by a process that died would make bind fail, so it is
+				// removed; any other file, or a socket a live server accepts on, is kept
+				struct stat info;
+				if (::lstat(endpoint.c_str(), &info) == 0)
+				{
+					if (!S_ISSOCK(info.st_mode) || accepting(address))
+					{
+						error = "address in use";
+						return false;
+					}
+					::unlink(endpoint.c_str());
+				}
+				fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+				if (fd < 0 || ::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+					return fail(error);
+				path = endpoint;
+			}
+			else
+			{
+				addrinfo* addresses = resolve(host == "*" ? "" : host, port, true, error);
+				if (!addresses) return false;
+				fd = ::socket(addresses->ai_family, SOCK_STREAM, 0);
+				int reuse = 1;
+				if (fd >= 0) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+				bool bound = fd >= 0 && ::bind(fd, addresses->ai_addr, addresses->ai_addrlen) == 0;
+				freeaddrinfo(addresses);
+				if (!bound) return fail(error);
+			}
+
+			if (::listen(fd, 16) != 0) return fail(error);
+			ignoreBrokenPipes();
+			return true;
+#else
+			error = "sockets are not supported on Windows";
+			return false;
+#endif
+		}
+
+		bool isOpen() const { return fd >= 0; }
+
+		// Waits up to timeoutMs for a client, returning null on timeout
+		std::unique_ptr<Connection> accept(int timeoutMs)
+		{
+#ifndef _WIN32
+			pollfd request = { fd, POLLIN, 0 };
+			if (fd < 0 || ::poll(&request, 1, timeoutMs) <= 0) return nullptr;
+			int client = ::accept(fd, nullptr, nullptr);
+			if (client < 0) return nullptr;
+			return std::unique_ptr<Connection>(new Connection(client));
+#else
+			return nullptr;
+#endif
+		}
+
+		void close()
+		{
+#ifndef _WIN32
+			if (fd >= 0) ::close(fd);
+			if (!path.empty()) ::unlink(path.c_str());
+#endif
+			fd = -1;
+			path.clear();
+		}
+
+	private:
+		int fd = -1;
+		std::string path;					// Unix socket file to remove on close
+
+		bool fail(std::string& error)
+		{
+			error = std::strerror(errno);
+			close();
+			return false;
+		}
+
+#ifndef _WIN32
+		static bool accepting(const sockaddr_un& address)
+		{
+			int probe = ::socket(AF_UNIX, SOCK_STREAM, 0);
+			if (probe < 0) return true;
+			bool connected = ::connect(probe, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0;
+			::close(probe);
+			return connected;
+		}
+#endif
+	};
+
+	// Connects to an endpoint, returning null with the reason on failure
+	inline std::unique_ptr<Connection> connect(const std::string& endpoint, std::string& error)
+	{
+#ifndef _WIN32
+		int fd = -1;
+		std::string host, port;
+		if (!splitEndpoint(endpoint, host, port))
+		{
+			sockaddr_un address = {};
+			address.sun_family = AF_UNIX;
+			std::strncpy(address.sun_path, endpoint.c_str(), sizeof(address.sun_path) - 1);
+			fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+			if (fd >= 0 && ::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+			{
+				::close(fd);
+				fd = -1;
+			}
+		}
+		else
+		{
+			addrinfo* addresses = resolve(host, port, false, error);
+			if (!addresses) return nullptr;
+			for (addrinfo* a = addresses; a && fd < 0; a = a->ai_next)
+			{
+				fd = ::socket(a->ai_family, SOCK_STREAM, 0);
+				if (fd >= 0 && ::connect(fd, a->ai_addr, a->ai_addrlen) != 0)
+				{
+					::close(fd);
+					fd = -1;
+				}
+			}
+			freeaddrinfo(addresses);
+
+			// Requests are small messages; do not hold them back waiting for more
+			int noDelay = 1;
+			if (fd >= 0) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+		}
+
+		if (fd < 0)
+		{
+			error = std::strerror(errno);
+			return nullptr;
+		}
+		ignoreBrokenPipes();
+		return std::unique_ptr<Connection>(new Connection(fd));
+#else
+		error = "sockets are not supported on Windows";
+		return nullptr;
+#endif
+	}
+}
@@ -7,8 +7,18 @@ private:
 	Ray center;
 	float radius;
 	std::shared_ptr<Material> mat;
+	Track<Point3> path;					// Centers over time, if animated
 	AABB bbox;
+	uint32_t primId;
 
+	void setBoundingBox() {
+		// Enclose the sphere at both ends of the shutter interval
+		AABB box1, box2;
+		motionBounds(box1, box2);
+		bbox = AABB(box1, box2);
+	}
+
+public:
 	static void getSphereUV(const Point3& p, float& u, float& v)
 	{
 		float theta = std::acos(-p.y);
@@ -18,26 +28,50 @@ private:
 		v = theta / pi;
 	}
 
-public:
+	static void getSphereTangents(const Point3& p, float radius, Vec3& dpdu, Vec3& dpdv)
+	{
+		// Derivatives of the point on the sphere with respect to the (u, v) of getSphereUV
+		float sinTheta = std::fmax(std::sqrt(p.x * p.x + p.z * p.z), 1e-6f);
+		dpdu = (2 * pi * radius) * Vec3(p.z, 0.0f, -p.x);
+		dpdv = (pi * radius) * Vec3(-p.x * p.y / sinTheta, sinTheta, -p.y * p.z / sinTheta);
+	}
+
 	// Stationary Sphere
 	Sphere(const Point3& staticCenter, float radius, std::shared_ptr<Material> mat)
 		: center(staticCenter, Vec3()), radius(std::fmax(0.0f, radius)), mat(mat) 
 	{
 		auto rVec = Vec3(radius, radius, radius);
 		bbox = AABB(staticCenter - rVec, staticCenter + rVec);
+		primId = registerPrimitive(this);
 	}
 
 	// Moving Sphere
 	Sphere(const Point3& center1, const Point3& center2, float radius, std::shared_ptr<Material> mat)
 		: center(center1, center2 - center1), radius(std::fmax(0.0f, radius)), mat(mat) 
 	{
-		auto rVec = Vec3(radius, radius, radius);
-		AABB box1 = AABB(center1 - rVec, center1 + rVec);
-		AABB box2 = AABB(center2 - rVec, center2 + rVec);
-		bbox = AABB(box1, box2);
+		setBoundingBox();
+		primId = registerPrimitive(this);
+	}
+
+	// Animates the center at time 0 of the shutter; motion within the shutter is kept
+	void setPath(const Track<Point3>& path) {
+		this->path = path;
+		update(path.startTime());
+	}
+
+	bool update(float time) override {
+		if (path.empty()) return false;
+		Point3 next = path.at(time);
+		if (next.x == center.origin.x && next.y == center.origin.y && next.z == center.origin.z) {
+			return false;
+		}
+		center = Ray(next, center.dir);
+		setBoundingBox();
+		return true;
 	}
 
-	bool hit(const Ray& ray, Interval rayT, HitRecord& record) const override {
+	bool hit(const Ray& ray, Interval rayT, RayHit& rayHit) const override {
+		Stats::primitiveTests(1);
 		Vec3 currentCenter = center.at(ray.time);
 		Vec3 oc = currentCenter - ray.origin;
 		float a = sqrMag(ray.dir);
@@ -60,16 +94,38 @@ public:
 			}
 		}
 
-		record.t = root;
+		rayHit.t = root;
+		rayHit.primId = primId;
+		rayHit.instId = noInstance;
+		rayHit.b0 = rayHit.b1 = 0;
+
+		Stats::primitiveHit();
+		return true;
+	}
+
+	void surface(const Ray& ray, const RayHit& rayHit, HitRecord& record) const override {
+		Vec3 currentCenter = center.at(ray.time);
+
+		record.t = rayHit.t;
 		record.p = ray.at(record.t);
 
 		// Get the outward unit normal
 		Vec3 outwardNormal = (record.p - currentCenter) / radius;
 		record.setFaceNormal(ray, outwardNormal);
 		getSphereUV(outwardNormal, record.u, record.v);
-		record.mat = mat;
+		getSphereTangents(outwardNormal, radius, record.dpdu, record.dpdv);
+		record.mat = mat.get();
+	}
 
-		return true;
+	std::shared_ptr<Hittable> replicate(Replicas&) const override {
+		return std::make_shared<Sphere>(*this);
+	}
+
+	void motionBounds(AABB& start, AABB& end) const override {
+		auto rVec = Vec3(radius, radius, radius);
+		Point3 center2 = center.at(1.0f);
+		start = AABB(center.origin - rVec, center.origin + rVec);
+		end = AABB(center2 - rVec, center2 + rVec);
 	}
 
 	AABB boundingBox() const override { return bbox; }
@@ -0,0 +1,221 @@
+#pragma once
+
+#include "hittable.h"
+#include "hittable_list.h"
+#include "simd.h"
+#include "sphere.h"
+
+#include <algorithm>
+#include <vector>
+
+// Description of a single sphere to be packed into a SphereGroup
+struct SphereDesc
+{
+	Point3 center1;
+	Point3 center2;
+	float radius;
+	std::shared_ptr<Material> mat;
+};
+
+class SphereGroup : public Hittable
+{
+public:
+	// Maximum spheres per group: one AVX vector or two SSE vectors
+	static const int capacity = 8;
+
+	SphereGroup() : count(0)
+	{
+		// Unused lanes hold NaN centers so they never report a hit
+		const float nan = std::numeric_limits<float>::quiet_NaN();
+		std::fill(cx, cx + capacity, nan);
+		std::fill(cy, cy + capacity, nan);
+		std::fill(cz, cz + capacity, nan);
+		std::fill(dx, dx + capacity, 0.0f);
+		std::fill(dy, dy + capacity, 0.0f);
+		std::fill(dz, dz + capacity, 0.0f);
+		std::fill(radius, radius + capacity, 0.0f);
+		std::fill(matId, matId + capacity, 0);
+		bbox = startBox = endBox = AABB::Empty;
+		firstPrimId = registerPrimitive(this, capacity);
+	}
+
+	int size() const { return count; }
+	bool full() const { return count == capacity; }
+
+	void add(const SphereDesc& sphere)
+	{
+		if (full()) return;
+
+		int i = count++;
+		float r = std::fmax(0.0f, sphere.radius);
+		cx[i] = sphere.center1.x;
+		cy[i] = sphere.center1.y;
+		cz[i] = sphere.center1.z;
+		dx[i] = sphere.center2.x - sphere.center1.x;
+		dy[i] = sphere.center2.y - sphere.center1.y;
+		dz[i] = sphere.center2.z - sphere.center1.z;
+		radius[i] = r;
+		matId[i] = materialIndex(sphere.mat);
+
+		// Enclose the sphere at both ends of its motion
+		auto rVec = Vec3(r, r, r);
+		AABB box1 = AABB(sphere.center1 - rVec, sphere.center1 + rVec);
+		AABB box2 = AABB(sphere.center2 - rVec, sphere.center2 + rVec);
+		bbox = AABB(bbox, AABB(box1, box2));
+		startBox = AABB(startBox, box1);
+		endBox = AABB(endBox, box2);
+	}
+
+	bool hit(const Ray& ray, Interval rayT, RayHit& rayHit) const override
+	{
+		// Intersect all spheres in the group lane-parallel, then keep the closest root
+		Stats::primitiveTests(count);
+		const SimdFloat time(ray.time);
+		const SimdFloat ox(ray.origin.x), oy(ray.origin.y), oz(ray.origin.z);
+		const SimdFloat rdx(ray.dir.x), rdy(ray.dir.y), rdz(ray.dir.z);
+		const SimdFloat a(sqrMag(ray.dir));
+		const SimdFloat invA(1.0f / sqrMag(ray.dir));
+		const SimdFloat tMin(rayT.min), zero(0.0f);
+
+		float closest = rayT.max;
+		int hitLane = -1;
+
+		for (int base = 0; base < count; base += SimdFloat::width)
+		{
+			SimdFloat ocx = SimdFloat::load(cx + base) + time * SimdFloat::load(dx + base) - ox;
+			SimdFloat ocy = SimdFloat::load(cy + base) + time * SimdFloat::load(dy + base) - oy;
+			SimdFloat ocz = SimdFloat::load(cz + base) + time * SimdFloat::load(dz + base) - oz;
+			SimdFloat r = SimdFloat::load(radius + base);
+
+			SimdFloat h = rdx * ocx + rdy * ocy + rdz * ocz;
+			SimdFloat c = ocx * ocx + ocy * ocy + ocz * ocz - r * r;
+			SimdFloat discriminant = h * h - a * c;
+			SimdFloat sqrtd = sqrt(max(discriminant, zero));
+
+			// Take the near root if it is in range, otherwise fall back to the far root
+			SimdFloat tMax(closest);
+			SimdFloat root0 = (h - sqrtd) * invA;
+			SimdFloat root1 = (h + sqrtd) * invA;
+			SimdFloat nearInRange = (root0 > tMin) & (root0 < tMax);
+			SimdFloat root = select(nearInRange, root0, root1);
+			SimdFloat valid = (discriminant >= zero) & (root > tMin) & (root < tMax);
+
+			int bits = mask(valid);
+			if (!bits) continue;
+
+			float roots[SimdFloat::width];
+			root.store(roots);
+			for (int lane = 0; lane < SimdFloat::width; lane++)
+			{
+				if ((bits >> lane & 1) && roots[lane] < closest)
+				{
+					closest = roots[lane];
+					hitLane = base + lane;
+				}
+			}
+		}
+
+		if (hitLane < 0) return false;
+
+		// Each lane owns one primitive id, so the lane is recovered from the id
+		rayHit.t = closest;
+		rayHit.primId = firstPrimId + hitLane;
+		rayHit.instId = noInstance;
+		rayHit.b0 = rayHit.b1 = 0;
+
+		Stats::primitiveHit();
+		return true;
+	}
+
+	void surface(const Ray& ray, const RayHit& rayHit, HitRecord& record) const override
+	{
+		int lane = rayHit.primId - firstPrimId;
+		Point3 currentCenter(
+			cx[lane] + ray.time * dx[lane],
+			cy[lane] + ray.time * dy[lane],
+			cz[lane] + ray.time * dz[lane]);
+
+		record.t = rayHit.t;
+		record.p = ray.at(record.t);
+
+		Vec3 outwardNormal = (record.p - currentCenter) / radius[lane];
+		record.setFaceNormal(ray, outwardNormal);
+		Sphere::getSphereUV(outwardNormal, record.u, record.v);
+		Sphere::getSphereTangents(outwardNormal, radius[lane], record.dpdu, record.dpdv);
+		record.mat = materials[matId[lane]].get();
+	}
+
+	std::shared_ptr<Hittable> replicate(Replicas&) const override
+	{
+		return std::make_shared<SphereGroup>(*this);
+	}
+
+	void motionBounds(AABB& start, AABB& end) const override
+	{
+		start = startBox;
+		end = endBox;
+	}
+
+	AABB boundingBox() const override { return bbox; }
+
+private:
+	// Structure of arrays, one lane per sphere
+	float cx[capacity], cy[capacity], cz[capacity];
+	float dx[capacity], dy[capacity], dz[capacity];
+	float radius[capacity];
+	unsigned char matId[capacity];
+
+	std::vector<std::shared_ptr<Material>> materials;
+	int count;
+	AABB bbox;
+	AABB startBox, endBox;				// Bounds at both ends of the shutter
+	uint32_t firstPrimId;
+
+	unsigned char materialIndex(const std::shared_ptr<Material>& mat)
+	{
+		// Index into the group's material palette, adding the material if it is new
+		for (size_t i = 0; i < materials.size(); i++)
+		{
+			if (materials[i] == mat) return static_cast<unsigned char>(i);
+		}
+		materials.push_back(mat);
+		return static_cast<unsigned char>(materials.size() - 1);
+	}
+};
+
+inline void packSpheres(
+	std::vector<SphereDesc>& spheres, size_t start, size_t end, HittableList& groups
+)
+{
+	if (end - start <= static_cast<size_t>(SphereGroup::capacity))
+	{
+		auto group = std::make_shared<SphereGroup>();
+		for (size_t i = start; i < end; i++)
+			group->add(spheres[i]);
+		groups.add(group);
+		return;
+	}
+
+	// Split at the median center along the longest axis of the centers' extent, as the BVH
+	// does for its nodes, so that each group stays spatially compact
+	AABB centroids = AABB::Empty;
+	for (size_t i = start; i < end; i++)
+		centroids = AABB(centroids, AABB(spheres[i].center1, spheres[i].center1));
+	int axis = centroids.longestAxis();
+
+	auto mid = start + (end - start) / 2;
+	std::nth_element(spheres.begin() + start, spheres.begin() + mid, spheres.begin() + end,
+		[axis](const SphereDesc& a, const SphereDesc& b) {
+			return a.center1[axis] < b.center1[axis];
+		});
+
+	packSpheres(spheres, start, mid, groups);
+	packSpheres(spheres, mid, end, groups);
+}
+
+inline void packSpheres(std::vector<SphereDesc>& spheres, HittableList& groups)
+{
+	// Pack spheres into groups of up to SphereGroup::capacity, which then serve as the
+	// wide leaves of a BVH built over the list
+	packSpheres(spheres, 0, spheres.size(), groups);
+}
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <string>
+
+// Traversal statistics, enabled by building with RAYTRACER_STATS (the CMake option of the
+// same name). The counters live in a thread-local block, so counting never contends; the
+// camera takes the difference of a thread's block over each tile and adds it to the
+// render's totals. When disabled, every counting function is empty and the hot paths
+// compile exactly as without them.
+#ifndef RAYTRACER_STATS
+#define RAYTRACER_STATS 0
+#endif
+
+// Why a path stopped
+enum class Termination
+{
+	Miss,			// Escaped to the background
+	Absorbed,		// Hit a surface that does not scatter
+	Emitted,		// Hit a light, which does not scatter
+	MaxDepth,		// Reached the bounce limit
+	Count
+};
+
+struct TraversalStats
+{
+	// Path lengths of this many rays or more share the last histogram bin
+	static const int lengthBins = 64;
+	static const int terminationCount = static_cast<int>(Termination::Count);
+
+	uint64_t rays = 0;
+	uint64_t nodesVisited = 0;			// BVH nodes whose box the ray entered
+	uint64_t aabbTests = 0;				// Calls of AABB::hit, whether or not they hit
+	uint64_t primitiveTests = 0;
+	uint64_t primitiveHits = 0;
+	uint64_t pathLengths[lengthBins] = {};
+	uint64_t terminations[terminationCount] = {};
+
+	// Work done, used as the per-pixel cost of the heatmap
+	uint64_t cost() const { return aabbTests + primitiveTests; }
+
+	TraversalStats& operator+=(const TraversalStats& other)
+	{
+		rays += other.rays;
+		nodesVisited += other.nodesVisited;
+		aabbTests += other.aabbTests;
+		primitiveTests += other.primitiveTests;
+		primitiveHits += other.primitiveHits;
+		for (int i = 0; i < lengthBins; i++)
+			pathLengths[i] += other.pathLengths[i];
+		for (int i = 0; i < terminationCount; i++)
+			terminations[i] += other.terminations[i];
+		return *this;
+	}
+
+	TraversalStats operator-(const TraversalStats& other) const
+	{
+		TraversalStats difference = *this;
+		difference.rays -= other.rays;
+		difference.nodesVisited -= other.nodesVisited;
+		difference.aabbTests -= other.aabbTests;
+		difference.primitiveTests -= other.primitiveTests;
+		difference.primitiveHits -= other.primitiveHits;
+		for (int i = 0; i < lengthBins; i++)
+			difference.pathLengths[i] -= other.pathLengths[i];
+		for (int i = 0; i < terminationCount; i++)
+			difference.terminations[i] -= other.terminations[i];
+		return difference;
+	}
+
+	void print(std::ostream& out) const
+	{
+		std::streamsize precision = out.precision();
+		double perRay = rays > 0 ? 1.0 / rays : 0.0;
+		out << "Traversal statistics:\n" << std::fixed << std::setprecision(2)
+			<< "  Rays:                 " << rays << "\n"
+			<< "  Nodes visited/ray:    " << nodesVisited * perRay << "\n"
+			<< "  AABB tests/ray:       " << aabbTests * perRay << "\n"
+			<< "  Primitive tests/ray:  " << primitiveTests * perRay << "\n"
+			<< "  Primitive hits/ray:   " << primitiveHits * perRay << "\n";
+
+		static const char* reasons[terminationCount] = { "miss", "absorbed", "emitted", "max depth" };
+		uint64_t paths = 0;
+		for (int i = 0; i < terminationCount; i++)
+			paths += terminations[i];
+		double perPath = paths > 0 ? 100.0 / paths : 0.0;
+
+		out << "  Path termination:    ";
+		for (int i = 0; i < terminationCount; i++)
+			out << " " << reasons[i] << " " << terminations[i] * perPath << "%";
+		out << "\n";
+
+		// The populated part of the length histogram is printed in at most 16 rows
+		int last = lengthBins - 1;
+		while (last > 1 && pathLengths[last] == 0)
+			last--;
+		int rowWidth = (last + 15) / 16;
+
+		out << "  Path length (rays):\n";
+		for (int first = 1; first <= last; first += rowWidth)
+		{
+			int end = std::min(first + rowWidth, last + 1);
+			uint64_t count = 0;
+			for (int i = first; i < end; i++)
+				count += pathLengths[i];
+
+			std::string label = std::to_string(first);
+			if (end - first > 1) label += "-" + std::to_string(end - 1);
+			if (end - 1 == lengthBins - 1) label += "+";
+
+			double percent = count * perPath;
+			out << "    " << std::left << std::setw(7) << label << std::right << std::setw(7) << percent
+				<< "% " << std::string(static_cast<size_t>(percent / 2.0), '#') << "\n";
+		}
+		out.unsetf(std::ios::floatfield);
+		out.precision(precision);
+	}
+};
+
+namespace Stats
+{
+#if RAYTRACER_STATS
+	const bool enabled = true;
+
+	inline TraversalStats& local()
+	{
+		thread_local TraversalStats stats;
+		return stats;
+	}
+
+	inline void ray() { local().rays++; }
+	inline void nodeVisit() { local().nodesVisited++; }
+	inline void aabbTest() { local().aabbTests++; }
+	inline void primitiveTests(int count) { local().primitiveTests += count; }
+	inline void primitiveHit() { local().primitiveHits++; }
+
+	inline void pathEnd(Termination reason, int length)
+	{
+		TraversalStats& stats = local();
+		stats.terminations[static_cast<int>(reason)]++;
+		stats.pathLengths[std::min(length, TraversalStats::lengthBins - 1)]++;
+	}
+
+	// Leaves the traversal counters as they were before the scope, so that work redone to
+	// reconstruct a hit is not counted as traversal
+	class Uncounted
+	{
+	public:
+		Uncounted()
+		{
+			const TraversalStats& stats = local();
+			nodesVisited = stats.nodesVisited;
+			aabbTests = stats.aabbTests;
+			primitiveTests = stats.primitiveTests;
+			primitiveHits = stats.primitiveHits;
+		}
+
+		~Uncounted()
+		{
+			TraversalStats& stats = local();
+			stats.nodesVisited = nodesVisited;
+			stats.aabbTests = aabbTests;
+			stats.primitiveTests = primitiveTests;
+			stats.primitiveHits = primitiveHits;
+		}
+
+	private:
+		uint64_t nodesVisited, aabbTests, primitiveTests, primitiveHits;
+	};
+#else
+	const bool enabled = false;
+
+	inline TraversalStats local() { return TraversalStats(); }
+
+	inline void ray() {}
+	inline void nodeVisit() {}
+	inline void aabbTest() {}
+	inline void primitiveTests(int) {}
+	inline void primitiveHit() {}
+	inline void pathEnd(Termination, int) {}
+
+	class Uncounted
+	{
+	public:
+		Uncounted() {}
+	};
+#endif
+
+	// Maps a cost in [0, 1] to a dark blue to yellow color ramp
+	inline void heatColor(float x, unsigned char rgb[3])
+	{
+		static const float ramp[5][3] = {
+			{ 0.05f, 0.03f, 0.20f }, { 0.35f, 0.05f, 0.55f }, { 0.80f, 0.20f, 0.35f },
+			{ 0.98f, 0.55f, 0.10f }, { 0.99f, 0.95f, 0.40f }
+		};
+		x = std::min(std::max(x, 0.0f), 1.0f) * 4.0f;
+		int i = std::min(static_cast<int>(x), 3);
+		float f = x - i;
+		for (int c = 0; c < 3; c++)
+			rgb[c] = static_cast<unsigned char>(255.0f * (ramp[i][c] + f * (ramp[i + 1][c] - ramp[i][c])));
+	}
+}
@@ -1,77 +1,120 @@
 #pragma once
 
+#include "mipmap.h"
 #include "rtw_stb_image.h"
 
+#include <cstdint>
+
+// Textures form a small node graph evaluated by switching on a type tag: checker nodes
+// select one of their children, and solid color and image nodes end the walk. Only
+// CustomTexture, the extension point for other patterns, goes through a virtual call.
 class Texture
 {
 public:
-	virtual ~Texture() = default;
-	virtual Color value(float u, float v, const Point3& p) const = 0;
+	enum class Type : uint8_t
+	{
+		SolidColor,
+		Checker,
+		Image,
+		Custom
+	};
+
+	Type type() const { return kind; }
+	bool isConstant() const { return kind == Type::SolidColor; }
+	const Color& constant() const { return albedo; }
+
+	// The filter widths are the footprint of the lookup along u and v, used by image textures
+	// to choose a mip level. Zero requests an unfiltered lookup.
+	Color value(float u, float v, const Point3& p, float filterU = 0.0f, float filterV = 0.0f) const;
+
+protected:
+	Type kind;
+	Color albedo;						// Solid color
+	float invScale = 1.0f;				// Checker
+	std::shared_ptr<Texture> even;
+	std::shared_ptr<Texture> odd;
+	std::shared_ptr<MipMap> image;		// Image
+
+	Texture(Type kind) : kind(kind) {}
+
+private:
+	bool checkerIsEven(const Point3& p) const
+	{
+		int x = static_cast<int>(std::floor(invScale * p.x));
+		int y = static_cast<int>(std::floor(invScale * p.y));
+		int z = static_cast<int>(std::floor(invScale * p.z));
+
+		return (x + y + z) % 2 == 0;
+	}
+
+	Color imageValue(float u, float v, float filterU, float filterV) const
+	{
+		// If there is no texture data return solid magenta for debugging
+		if (image->height() <= 0) return Color(1.0f, 1.0f, 0.0f);
+
+		// Clamp input texture coordinates to [0, 1] x [1, 0]
+		u = Interval(0, 1).clamp(u);
+		v = 1.0f - Interval(0, 1).clamp(v); // Flip V to image coordinates
+
+		return image->lookup(u, v, filterU, filterV);
+	}
 };
 
 class SolidColor : public Texture
 {
-private:
-	Color albedo;
-
 public:
-	SolidColor(const Color& albedo) : albedo(albedo) {}
-	SolidColor(float r, float g, float b) : SolidColor(Color(r, g, b)) {}
-
-	Color value(float u, float v, const Point3& p) const override
+	SolidColor(const Color& albedo) : Texture(Type::SolidColor)
 	{
-		return albedo;
+		this->albedo = albedo;
 	}
+	SolidColor(float r, float g, float b) : SolidColor(Color(r, g, b)) {}
 };
 
 class CheckerTexture : public Texture
 {
-private:
-	float invScale;
-	std::shared_ptr<Texture> even;
-	std::shared_ptr<Texture> odd;
-
 public:
 	CheckerTexture(float scale, std::shared_ptr<Texture> even, std::shared_ptr<Texture> odd)
-		: invScale(1.0f / scale), even(even), odd(odd) {}
-	CheckerTexture(float scale, const Color& c1, const Color& c2)
-		: CheckerTexture(scale, std::make_shared<SolidColor>(c1), std::make_shared<SolidColor>(c2)) {}
-
-	Color value(float u, float v, const Point3& p) const override
+		: Texture(Type::Checker)
 	{
-		int x = static_cast<int>(std::floor(invScale * p.x));
-		int y = static_cast<int>(std::floor(invScale * p.y));
-		int z = static_cast<int>(std::floor(invScale * p.z));
-
-		bool isEven = (x + y + z) % 2 == 0;
-
-		// Set the value of the even and odd textures based on their texture implementations
-		return isEven ? even->value(u, v, p) : odd->value(u, v, p);
+		invScale = 1.0f / scale;
+		this->even = even;
+		this->odd = odd;
 	}
+	CheckerTexture(float scale, const Color& c1, const Color& c2)
+		: CheckerTexture(scale, std::make_shared<SolidColor>(c1), std::make_shared<SolidColor>(c2)) {}
 };
 
 class ImageTexture : public Texture
 {
-private:
-	rtw_image image;
-
 public:
-	ImageTexture(const char* filename) : image(filename) {}
-
-	Color value(float u, float v, const Point3& p) const override
+	ImageTexture(const char* filename) : Texture(Type::Image)
 	{
-		// If there is no texture data return solid magenta for debugging
-		if (image.height() <= 0) return Color(1.0f, 1.0f, 0.0f);
+		image = TextureLoader::load(filename);
+	}
+};
 
-		// Clamp input texture coordinates to [0, 1] x [1, 0]
-		u = Interval(0, 1).clamp(u);
-		v = 1.0f - Interval(0, 1).clamp(v); // Flip V to image coordinates
+// Base for textures outside the closed set
+class CustomTexture : public Texture
+{
+public:
+	CustomTexture() : Texture(Type::Custom) {}
+	virtual ~CustomTexture() = default;
 
-		auto i = static_cast<int>(u * image.width());
-		auto j = static_cast<int>(v * image.height());
-		auto pixel = image.pixel_data(i, j);
+	virtual Color valueCustom(float u, float v, const Point3& p) const = 0;
+};
 
-		auto colorScale = 1.0f / 255.0f;
-		return Color(colorScale * pixel[0], colorScale * pixel[1], colorScale * pixel[2]);
+inline Color Texture::value(float u, float v, const Point3& p, float filterU, float filterV) const
+{
+	// Walk down through checker nodes until a leaf produces the color
+	const Texture* node = this;
+	while (true)
+	{
+		switch (node->kind)
+		{
+		case Type::SolidColor: return node->albedo;
+		case Type::Checker: node = node->checkerIsEven(p) ? node->even.get() : node->odd.get(); break;
+		case Type::Image: return node->imageValue(u, v, filterU, filterV);
+		default: return static_cast<const CustomTexture*>(node)->valueCustom(u, v, p);
+		}
 	}
-};
\ No newline at end of file
+}
@@ -0,0 +1,273 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Texels are stored as square tiles of 8-bit RGB, in a pre-tiled file with every mip level
+// of an image. Tiles are read on demand through a process-wide cache that keeps the most
+// recently used ones under a fixed memory budget. A file stays open while its pyramid holds
+// it, and closing it drops its tiles from the cache.
+
+const int textureTileSize = 16;
+const int textureTileBytes = textureTileSize * textureTileSize * 3;
+
+struct TextureTile
+{
+	unsigned char texels[textureTileBytes];		// RGB, scanline order within the tile
+
+	const unsigned char* texel(int x, int y) const
+	{
+		return &texels[(y * textureTileSize + x) * 3];
+	}
+};
+
+// Layout of a tiled texture file: a header, the size of each level, then the tiles of
+// each level in row-major tile order, starting with the full resolution level.
+struct TiledFileHeader
+{
+	char magic[4];
+	uint32_t tileSize;
+	uint32_t levelCount;
+	uint32_t reserved;
+	uint64_t sourceSize;		// Byte size and modification time in nanoseconds of the
+	uint64_t sourceTime;		// source image, to detect stale files
+};
+
+struct TiledLevel
+{
+	int width, height;
+	int tilesX, tilesY;
+	uint64_t firstTile;			// Index of the level's first tile in the file
+};
+
+class TextureCache;
+
+// Open tiled texture file. Tiles are cached under a serial number that is never reused, so
+// a tile of a closed file cannot be mistaken for one of a later file.
+class TextureFile
+{
+public:
+	~TextureFile();
+
+	TextureFile(const TextureFile&) = delete;
+	TextureFile& operator=(const TextureFile&) = delete;
+
+private:
+	friend class TextureCache;
+
+	std::FILE* file;
+	int64_t dataStart;
+	uint64_t serial;
+	std::mutex mutex;
+
+	TextureFile(std::FILE* file, int64_t dataStart, uint64_t serial)
+		: file(file), dataStart(dataStart), serial(serial) {}
+};
+
+class TextureCache
+{
+public:
+	static TextureCache& instance()
+	{
+		static TextureCache cache;
+		return cache;
+	}
+
+	// Resident tile memory cap in bytes. Tiles held by in-flight lookups may briefly exceed it.
+	void setCapacity(size_t bytes)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		capacity = bytes;
+		evict();
+	}
+
+	size_t residentBytes() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return tiles.size() * sizeof(TextureTile);
+	}
+
+	// Open a tiled texture file, or null if it cannot be read. The file is closed when the
+	// last pointer to it goes.
+	std::shared_ptr<TextureFile> open(const std::string& path, std::vector<TiledLevel>& levels)
+	{
+		std::FILE* file = std::fopen(path.c_str(), "rb");
+		if (!file) return nullptr;
+
+		TiledFileHeader header;
+		if (!readLevels(file, header, levels))
+		{
+			std::fclose(file);
+			return nullptr;
+		}
+
+		int64_t dataStart = sizeof(TiledFileHeader) + header.levelCount * 2 * sizeof(uint32_t);
+		return std::shared_ptr<TextureFile>(new TextureFile(file, dataStart, nextSerial++));
+	}
+
+	const TextureTile* tile(TextureFile& file, uint64_t tileIndex)
+	{
+		// Threads remember their last few tiles, so neighbouring lookups skip the shared map.
+		// The returned tile stays valid until this thread's next call.
+		Key key(file.serial, tileIndex);
+		LocalSlot& slot = localSlots()[tileIndex % localSlotCount];
+		if (slot.tile && slot.key == key) return slot.tile.get();
+
+		slot.tile = fetch(file, key);
+		slot.key = key;
+		return slot.tile.get();
+	}
+
+	static bool readLevels(std::FILE* file, TiledFileHeader& header, std::vector<TiledLevel>& levels)
+	{
+		if (std::fread(&header, sizeof(header), 1, file) != 1) return false;
+		if (std::string(header.magic, 4) != "RTT2" || header.tileSize != textureTileSize)
+			return false;
+
+		levels.clear();
+		uint64_t firstTile = 0;
+		for (uint32_t i = 0; i < header.levelCount; i++)
+		{
+			uint32_t size[2];
+			if (std::fread(size, sizeof(size), 1, file) != 1) return false;
+
+			TiledLevel level;
+			level.width = static_cast<int>(size[0]);
+			level.height = static_cast<int>(size[1]);
+			level.tilesX = (level.width + textureTileSize - 1) / textureTileSize;
+			level.tilesY = (level.height + textureTileSize - 1) / textureTileSize;
+			level.firstTile = firstTile;
+			firstTile += static_cast<uint64_t>(level.tilesX) * level.tilesY;
+			levels.push_back(level);
+		}
+
+		return !levels.empty();
+	}
+
+private:
+	friend class TextureFile;
+
+	typedef std::pair<uint64_t, uint64_t> Key;		// File serial and tile index
+
+	struct KeyHash
+	{
+		size_t operator()(const Key& key) const
+		{
+			return std::hash<uint64_t>()(key.first * 0x9E3779B97F4A7C15ull ^ key.second);
+		}
+	};
+
+	struct Entry
+	{
+		std::shared_ptr<const TextureTile> tile;
+		std::list<Key>::iterator lruPosition;
+	};
+
+	struct LocalSlot
+	{
+		Key key;
+		std::shared_ptr<const TextureTile> tile;
+	};
+
+	static const int localSlotCount = 8;
+
+	mutable std::mutex mutex;
+	size_t capacity = 256u << 20;
+	std::atomic<uint64_t> nextSerial{0};
+	std::unordered_map<Key, Entry, KeyHash> tiles;
+	std::list<Key> lru;						// Most recently used at the front
+
+	TextureCache() {}
+
+	static int seek(std::FILE* file, int64_t offset)
+	{
+#ifdef _WIN32
+		return _fseeki64(file, offset, SEEK_SET);
+#else
+		return fseeko(file, static_cast<off_t>(offset), SEEK_SET);
+#endif
+	}
+
+	static LocalSlot* localSlots()
+	{
+		thread_local LocalSlot slots[localSlotCount];
+		return slots;
+	}
+
+	std::shared_ptr<const TextureTile> fetch(TextureFile& file, const Key& key)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto found = tiles.find(key);
+			if (found != tiles.end())
+			{
+				lru.splice(lru.begin(), lru, found->second.lruPosition);
+				return found->second.tile;
+			}
+		}
+
+		// Read outside the cache lock so misses on other files do not wait on this one
+		auto loaded = std::make_shared<TextureTile>();
+		{
+			std::lock_guard<std::mutex> lock(file.mutex);
+			int64_t offset = file.dataStart + static_cast<int64_t>(key.second * textureTileBytes);
+			if (seek(file.file, offset) != 0
+				|| std::fread(loaded->texels, textureTileBytes, 1, file.file) != 1)
+			{
+				std::fill(loaded->texels, loaded->texels + textureTileBytes, 0);
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		auto inserted = tiles.emplace(key, Entry());
+		if (inserted.second)
+		{
+			lru.push_front(key);
+			inserted.first->second.tile = loaded;
+			inserted.first->second.lruPosition = lru.begin();
+			evict();
+		}
+		return inserted.first->second.tile;
+	}
+
+	// Drops the tiles of a file that is closing
+	void close(uint64_t serial)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (auto key = lru.begin(); key != lru.end();)
+		{
+			if (key->first == serial)
+			{
+				tiles.erase(*key);
+				key = lru.erase(key);
+			}
+			else
+				++key;
+		}
+	}
+
+	void evict()
+	{
+		// Drop least recently used tiles until the resident size fits the budget, always
+		// keeping the most recent one
+		while (lru.size() > 1 && tiles.size() * sizeof(TextureTile) > capacity)
+		{
+			tiles.erase(lru.back());
+			lru.pop_back();
+		}
+	}
+};
+
+inline TextureFile::~TextureFile()
+{
+	TextureCache::instance().close(serial);
+	std::fclose(file);
+}
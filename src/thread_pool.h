@@ -0,0 +1,91 @@
+#pragma once
+
+#include "trace.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Fixed set of worker threads running submitted tasks in FIFO order. The destructor
+// finishes all queued tasks before joining.
+class ThreadPool
+{
+public:
+	// Workers are named after the pool in traces
+	explicit ThreadPool(int threadCount = 0, const std::string& name = "Pool")
+	{
+		if (threadCount <= 0)
+			threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+		for (int i = 0; i < threadCount; i++)
+			workers.emplace_back(&ThreadPool::workerLoop, this, name + " worker " + std::to_string(i));
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			stopping = true;
+		}
+		queueReady.notify_all();
+
+		for (auto& worker : workers)
+			worker.join();
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	int size() const { return static_cast<int>(workers.size()); }
+
+	template <typename F>
+	std::future<typename std::result_of<F()>::type> submit(F task)
+	{
+		typedef typename std::result_of<F()>::type Result;
+		auto packaged = std::make_shared<std::packaged_task<Result()>>(task);
+		std::future<Result> result = packaged->get_future();
+
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			tasks.push([packaged]() { (*packaged)(); });
+		}
+		queueReady.notify_one();
+
+		return result;
+	}
+
+private:
+	std::vector<std::thread> workers;
+	std::queue<std::function<void()>> tasks;
+	std::mutex queueMutex;
+	std::condition_variable queueReady;
+	bool stopping = false;
+
+	void workerLoop(std::string name)
+	{
+		Trace::instance().setThreadName(name);
+
+		while (true)
+		{
+			std::function<void()> task;
+
+			{
+				std::unique_lock<std::mutex> lock(queueMutex);
+				queueReady.wait(lock, [this]() { return stopping || !tasks.empty(); });
+				if (tasks.empty()) return;
+				task = std::move(tasks.front());
+				tasks.pop();
+			}
+
+			task();
+		}
+	}
+};
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "trace.h"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Wall clock time spent in each phase of a run, reported as the startup breakdown.
+// Phases are listed in the order they were first recorded; repeated records accumulate.
+class Timings
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	static Timings& instance()
+	{
+		static Timings timings;
+		return timings;
+	}
+
+	void reset()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		phases.clear();
+		start = Clock::now();
+	}
+
+	// Seconds since the last reset
+	double elapsed() const { return seconds(start, Clock::now()); }
+
+	void add(const std::string& phase, double secs)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (auto& entry : phases)
+		{
+			if (entry.first == phase)
+			{
+				entry.second += secs;
+				return;
+			}
+		}
+		phases.emplace_back(phase, secs);
+	}
+
+	double get(const std::string& phase) const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (const auto& entry : phases)
+		{
+			if (entry.first == phase) return entry.second;
+		}
+		return 0.0;
+	}
+
+	void print(std::ostream& out) const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		out << "Startup breakdown:\n";
+		for (const auto& entry : phases)
+		{
+			out << "  " << std::left << std::setw(22) << (entry.first + ":")
+				<< std::fixed << std::setprecision(3) << entry.second << " s\n";
+		}
+		out.unsetf(std::ios::floatfield);
+	}
+
+	static double seconds(Clock::time_point from, Clock::time_point to)
+	{
+		return std::chrono::duration<double>(to - from).count();
+	}
+
+private:
+	mutable std::mutex mutex;
+	std::vector<std::pair<std::string, double>> phases;
+	Clock::time_point start = Clock::now();
+};
+
+// Adds the lifetime of the scope to a phase, and to the trace when tracing. The phase
+// name must be a string literal.
+class ScopedTimer
+{
+public:
+	explicit ScopedTimer(const char* phase) : phase(phase), start(Timings::Clock::now()) {}
+
+	~ScopedTimer()
+	{
+		auto end = Timings::Clock::now();
+		Timings::instance().add(phase, Timings::seconds(start, end));
+		if (Trace::instance().enabled())
+			Trace::instance().record(phase, "phase", start, end);
+	}
+
+	ScopedTimer(const ScopedTimer&) = delete;
+	ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+	const char* phase;
+	Timings::Clock::time_point start;
+};
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Timeline of a run in the Chrome trace event format, viewable in chrome://tracing or
+// Perfetto. Each thread appends complete events to its own buffer, so recording takes no
+// lock: buffers are linked into a list with a compare and swap when a thread records its
+// first event, and are only read by write(), once the traced work has finished. When
+// tracing is off, a scope costs one relaxed load.
+class Trace
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	static Trace& instance()
+	{
+		static Trace trace;
+		return trace;
+	}
+
+	// Clears earlier events and starts recording. Call while no traced work runs.
+	void start()
+	{
+		for (ThreadBuffer* buffer = buffers.load(); buffer; buffer = buffer->next)
+			buffer->events.clear();
+		epoch = Clock::now();
+		active.store(true, std::memory_order_relaxed);
+	}
+
+	bool enabled() const { return active.load(std::memory_order_relaxed); }
+
+	// Names the calling thread's track in the timeline
+	void setThreadName(const std::string& name)
+	{
+		if (enabled())
+			local().name = name;
+	}
+
+	void record(
+		const char* name, const char* category, Clock::time_point begin, Clock::time_point end,
+		const char* argName0 = nullptr, int arg0 = 0, const char* argName1 = nullptr, int arg1 = 0
+	)
+	{
+		local().events.push_back(Event{ name, category, begin, end, argName0, arg0, argName1, arg1 });
+	}
+
+	// Stops recording and writes the events. Call once the traced work has finished.
+	bool write(const std::string& filename)
+	{
+		active.store(false, std::memory_order_relaxed);
+
+		std::FILE* file = std::fopen(filename.c_str(), "wb");
+		if (!file) return false;
+
+		std::fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+		bool first = true;
+		for (ThreadBuffer* buffer = buffers.load(); buffer; buffer = buffer->next)
+		{
+			if (buffer->events.empty()) continue;
+
+			std::string name = buffer->name.empty() ? "Thread " + std::to_string(buffer->id) : buffer->name;
+			std::fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+				first ? "" : ",\n", buffer->id, escaped(name).c_str());
+			std::fprintf(file, ",\n{\"name\": \"thread_sort_index\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"sort_index\": %d}}",
+				buffer->id, buffer->id);
+			first = false;
+
+			for (const Event& event : buffer->events)
+			{
+				std::fprintf(file, ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+					escaped(event.name).c_str(), event.category, buffer->id, micros(epoch, event.begin), micros(event.begin, event.end));
+				if (event.argName0)
+				{
+					std::fprintf(file, ", \"args\": {\"%s\": %d", event.argName0, event.arg0);
+					if (event.argName1)
+						std::fprintf(file, ", \"%s\": %d", event.argName1, event.arg1);
+					std::fprintf(file, "}");
+				}
+				std::fprintf(file, "}");
+			}
+		}
+		std::fprintf(file, "\n]}\n");
+		return std::fclose(file) == 0;
+	}
+
+private:
+	struct Event
+	{
+		const char* name;				// Names and categories are string literals
+		const char* category;
+		Clock::time_point begin, end;
+		const char* argName0;
+		int arg0;
+		const char* argName1;
+		int arg1;
+	};
+
+	struct ThreadBuffer
+	{
+		int id;
+		std::string name;
+		std::vector<Event> events;
+		ThreadBuffer* next;
+	};
+
+	std::atomic<bool> active{ false };
+	std::atomic<ThreadBuffer*> buffers{ nullptr };
+	std::atomic<int> threadCount{ 0 };
+	Clock::time_point epoch = Clock::now();
+
+	ThreadBuffer& local()
+	{
+		// Buffers outlive their threads so that write() can read them afterwards
+		thread_local ThreadBuffer* buffer = nullptr;
+		if (!buffer)
+		{
+			buffer = new ThreadBuffer();
+			buffer->id = threadCount++;
+			buffer->events.reserve(1024);
+			buffer->next = buffers.load();
+			while (!buffers.compare_exchange_weak(buffer->next, buffer)) {}
+		}
+		return *buffer;
+	}
+
+	static double micros(Clock::time_point from, Clock::time_point to)
+	{
+		return std::chrono::duration<double, std::micro>(to - from).count();
+	}
+
+	static std::string escaped(const std::string& text)
+	{
+		std::string out;
+		for (char c : text)
+		{
+			if (c == '"' || c == '\\') out += '\\';
+			out += c;
+		}
+		return out;
+	}
+};
+
+// Records the lifetime of the scope as an event when tracing is on. The name, category and
+// argument names must be string literals.
+class TraceScope
+{
+public:
+	TraceScope(
+		const char* name, const char* category,
+		const char* argName0 = nullptr, int arg0 = 0, const char* argName1 = nullptr, int arg1 = 0
+	) : name(name), category(category), argName0(argName0), arg0(arg0), argName1(argName1), arg1(arg1),
+		active(Trace::instance().enabled())
+	{
+		if (active) start = Trace::Clock::now();
+	}
+
+	~TraceScope()
+	{
+		if (active)
+			Trace::instance().record(name, category, start, Trace::Clock::now(), argName0, arg0, argName1, arg1);
+	}
+
+	TraceScope(const TraceScope&) = delete;
+	TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+	const char* name;
+	const char* category;
+	const char* argName0;
+	int arg0;
+	const char* argName1;
+	int arg1;
+	bool active;
+	Trace::Clock::time_point start;
+};
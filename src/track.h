@@ -0,0 +1,35 @@
+#pragma once
+
+#include <utility>
+#include <vector>
+
+// Keyframed value of an animation, linearly interpolated between keys and held at the first
+// and last key outside them. Times are in seconds from the start of the animation.
+template <typename T>
+class Track
+{
+public:
+	bool empty() const { return keys.empty(); }
+
+	// Keys must be added in increasing time order
+	void add(float time, const T& value) { keys.emplace_back(time, value); }
+
+	T at(float time) const
+	{
+		if (time <= keys.front().first) return keys.front().second;
+		if (time >= keys.back().first) return keys.back().second;
+
+		size_t next = 1;
+		while (keys[next].first < time)
+			next++;
+		const auto& a = keys[next - 1];
+		const auto& b = keys[next];
+		float f = (time - a.first) / (b.first - a.first);
+		return a.second + f * (b.second - a.second);
+	}
+
+	float startTime() const { return keys.front().first; }
+
+private:
+	std::vector<std::pair<float, T>> keys;
+};